@@ -8,39 +8,52 @@
 #include <signal.h>
 #include <mqueue.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <getopt.h>
 
-#define MAX_CMD_LEN 1024
-#define SERVER_QUEUE_KEY 1234
-#define RESPONSE_QUEUE_KEY 5678 // Response queue for client
-
-typedef struct
-{
-    long msg_type;
-    pid_t client_pid;
-    char command[MAX_CMD_LEN];
-} Message;
+#include "protocol.h"
+#include "shm_ring.h"
 
 Message msg;
 int server_msg_queue;
 int response_msg_queue;
 int shutdown_msg_queue;
 char prompt[10] = "> ";
+ShmChannel *channel = NULL; // Set when talking to the server over shared memory
+int channel_attached = 0;    // Set once the REGISTER ack confirms the server has attached the channel
+mqd_t request_mq = (mqd_t)-1; // Set when talking to the event-loop server over POSIX queues
+mqd_t reply_mq = (mqd_t)-1;
+int server_socket = -1; // Set when talking to the server over its Unix socket (server -U)
+int passed_fd = -1;     // Output pipe that came with the last reply frame (MSG_FLAG_FD)
+int server_tcp = -1;    // Set when talking to a remote server (--connect)
+int next_request_id = 1;
+int interactive = 1; // Cleared by -c, -f and -b: stdout then carries command output only
 
-void *listen_for_shutdown(void *arg)
+// Opens the broadcast queue the server created for us while registering.
+// This happens before any other request, since EXIT unlinks it.
+mqd_t open_shutdown_queue(void)
 {
     char queue_name[64];
-    mqd_t mq;
-    char buffer[256];
-
     snprintf(queue_name, sizeof(queue_name), "/client_broadcast_%d", getpid());
 
     // Open the queue for reading
-    mq = mq_open(queue_name, O_RDONLY);
+    mqd_t mq = mq_open(queue_name, O_RDONLY);
     if (mq == (mqd_t)-1)
-    {
         perror("mq_open failed");
-        return NULL;
-    }
+    return mq;
+}
+
+void *listen_for_shutdown(void *arg)
+{
+    mqd_t mq = *(mqd_t *)arg;
+    char buffer[256];
 
     while (1)
     {
@@ -55,7 +68,7 @@ void *listen_for_shutdown(void *arg)
             printf("[Client Thread ** %lu]: Resource cleanup complete...\n", pthread_self());
             printf("[Client Thread ** %lu]: Shutting down...\n", pthread_self());
             printf("------------------------------------------------------------------------------------------------\n");
-            exit(0);
+            exit(interactive ? 0 : 1); // A script was cut short
         }
     }
 
@@ -64,41 +77,404 @@ void *listen_for_shutdown(void *arg)
 
 void handle_shutdown(int signo)
 {
+    (void)signo;
     printf("[Main Thread]: Server shutdown received. Exiting...\n");
     exit(0);
 }
 
-void send_command(char *cmd)
+// Sends cmd tagged with a fresh request ID and returns that ID
+int send_command(const char *cmd)
 {
     Message msg;
     msg.msg_type = 1;
     msg.client_pid = getpid();
+    msg.request_id = next_request_id++;
+    msg.seq = 0;
+    msg.flags = 0;
+    msg.status = 0;
     strcpy(msg.command, cmd);
+    msg.length = strlen(cmd);
+
+    if (request_mq != (mqd_t)-1)
+    {
+        if (mq_send_frame(request_mq, &msg) == -1)
+            perror("mq_send");
+        return msg.request_id;
+    }
+    if (server_tcp != -1)
+    {
+        if (tcp_send_frame(server_tcp, &msg) == -1)
+            perror("send");
+        return msg.request_id;
+    }
+    if (server_socket != -1)
+    {
+        msg.flags |= MSG_FLAG_FD; // We would rather read command output from its pipe
+        if (sock_send_frame(server_socket, &msg, -1, 0) == -1)
+            perror("sendmsg");
+        return msg.request_id;
+    }
+
+    // Until the server has attached our shared-memory channel, requests go
+    // through the server queue; the first REGISTER is what hands it over
+    if (channel != NULL && !channel_attached)
+        msg.flags |= MSG_FLAG_SHM;
+    else if (channel != NULL)
+    {
+        shm_ring_push(&channel->request, &msg, -1);
+        return msg.request_id;
+    }
 
-    if (msgsnd(server_msg_queue, &msg, sizeof(Message) - sizeof(long), 0) == -1)
+    if (msg_send_frame(server_msg_queue, &msg, 0) == -1)
     {
         perror("msgsnd");
     }
+    return msg.request_id;
+}
+
+int next_reply_message(Message *reply)
+{
+    if (channel_attached)
+        return shm_ring_pop(&channel->response, reply, -1);
+    if (reply_mq != (mqd_t)-1)
+        return mq_recv_frame(reply_mq, reply);
+    if (server_socket != -1)
+        return sock_recv_frame(server_socket, reply, &passed_fd, 0);
+    if (server_tcp != -1)
+        return tcp_recv_frame(server_tcp, reply);
+
+    // Replies are addressed by msg_type = client PID, so only take our own
+    return msg_recv_frame(response_msg_queue, reply, getpid(), 0);
+}
+
+void remove_channel(void)
+{
+    if (channel != NULL)
+        shm_channel_unlink(getpid());
 }
 
-void receive_response()
+// Registers with the server and returns its ack; exits if refused. The ack
+// to the REGISTER that hands over our shared-memory channel comes back on
+// the response queue, and says whether the server attached the channel.
+RegisterAck register_with_server(void)
 {
-    if (msgrcv(response_msg_queue, &msg, sizeof(Message) - sizeof(long), 0, 0) == -1)
+    int request_id = send_command("REGISTER");
+    Message reply;
+    do
     {
-        perror("msgrcv response");
-        return;
+        int rc = channel != NULL && !channel_attached ? msg_recv_frame(response_msg_queue, &reply, getpid(), 0) : next_reply_message(&reply);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1)
+        {
+            perror("receive register ack");
+            exit(1);
+        }
+    } while (reply.request_id != request_id || !(reply.flags & MSG_FLAG_END));
+
+    RegisterAck ack;
+    if (reply.status != 0 || reply.length != sizeof(RegisterAck))
+    {
+        fprintf(stderr, "[Main Thread -- %lu]: The server refused to register us\n", pthread_self());
+        exit(1);
     }
+    memcpy(&ack, reply.command, sizeof(ack));
 
-    printf("[Main Thread -- %lu] Received response from server\n=====================================================================\n%s\n", pthread_self(), msg.command);
+    if (channel != NULL && (ack.capabilities & CAP_SHM_CHANNEL))
+        channel_attached = 1;
+    else if (channel != NULL)
+    {
+        // Carry on over SysV rather than push requests nobody reads
+        fprintf(stderr, "[Main Thread -- %lu]: The server did not attach our shared-memory channel, using the SysV queues\n", pthread_self());
+        shm_channel_close(channel);
+        shm_channel_unlink(getpid());
+        channel = NULL;
+    }
+    return ack;
 }
 
-int main()
+void print_registration(const RegisterAck *ack)
 {
-    // signal(SIGINT, handle_shutdown);
+    printf("[Main Thread -- %lu]: Registered as client %d (capabilities:%s%s%s%s%s%s)\n", pthread_self(), ack->slot,
+           ack->capabilities & CAP_SHM_CHANNEL ? " shm-channel" : "",
+           ack->capabilities & CAP_BROADCAST ? " broadcast" : "",
+           ack->capabilities & CAP_PIPELINE ? " pipeline" : "",
+           ack->capabilities & CAP_EVENT_CORE ? " event-core" : "",
+           ack->capabilities & CAP_SHELL_POOL ? " shell-pool" : "",
+           ack->capabilities & CAP_FD_PASSING ? " fd-passing" : "");
+}
+
+// Prints the reply chunks of request_id as they arrive until its
+// end-of-stream marker and returns the exit status it carries (-1 on
+// receive errors). Non-interactive clients print the command output alone,
+// quiet ones nothing at all.
+int receive_response(int request_id, int quiet)
+{
+    int expected_seq = 0;
+    char last_char = '\n';
+    while (1)
+    {
+        if (next_reply_message(&msg) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == ECONNRESET)
+            {
+                // A connection has no broadcast queue: closing it is how the server says goodbye
+                fprintf(stderr, "[Main Thread -- %lu] The server closed the connection\n", pthread_self());
+                exit(interactive ? 0 : 1);
+            }
+            perror("msgrcv response");
+            return -1;
+        }
+        if (msg.request_id != request_id)
+        {
+            fprintf(stderr, "[Main Thread -- %lu] Dropped a reply chunk of request %d\n", pthread_self(), msg.request_id);
+            continue;
+        }
+
+        if (expected_seq == 0 && interactive && !quiet)
+            printf("[Main Thread -- %lu] Received response from server\n=====================================================================\n", pthread_self());
+        if (msg.seq != expected_seq)
+            fprintf(stderr, "[Main Thread -- %lu] Reply chunk %d arrived, expected %d\n", pthread_self(), msg.seq, expected_seq);
+        expected_seq = msg.seq + 1;
+
+        if (passed_fd != -1)
+        {
+            // The output comes straight from the command's pipe, not through the server
+            char buffer[65536];
+            ssize_t n;
+            while ((n = read(passed_fd, buffer, sizeof(buffer))) > 0 || (n == -1 && errno == EINTR))
+            {
+                if (n > 0 && !quiet)
+                {
+                    fwrite(buffer, 1, n, stdout);
+                    last_char = buffer[n - 1];
+                }
+            }
+            close(passed_fd);
+            passed_fd = -1;
+        }
+        if (!quiet && (interactive || !(msg.flags & MSG_FLAG_INFO)) && msg.length > 0)
+        {
+            fwrite(msg.command, 1, msg.length, stdout);
+            last_char = msg.command[msg.length - 1];
+        }
+        else if (!quiet && (msg.status == STATUS_TRY_LATER || msg.status == STATUS_TIMED_OUT || msg.status == STATUS_OUTPUT_LOST) && msg.length > 0)
+            fprintf(stderr, "%.*s\n", msg.length, msg.command); // Why the server refused or stopped the request
+        if (msg.flags & MSG_FLAG_END)
+        {
+            if (!interactive && last_char != '\n')
+                printf("\n"); // Builtin replies are not newline-terminated
+            if (interactive && !quiet)
+            {
+                printf("\n");
+                if (msg.status != 0)
+                    printf("[Main Thread -- %lu] Command exited with status %d\n", pthread_self(), msg.status);
+            }
+            fflush(stdout);
+            return msg.status;
+        }
+        fflush(stdout);
+    }
+}
+
+#define DEFAULT_BATCH_WINDOW 32
+
+// One command of a batch and the reply collected for it so far
+typedef struct
+{
+    char *command;
+    char *output;
+    size_t length;
+    size_t capacity;
+    int expected_seq;
+    int done;
+    int status;
+} BatchRequest;
+
+void batch_append(BatchRequest *request, const char *data, size_t length)
+{
+    if (request->length + length > request->capacity)
+    {
+        size_t capacity = request->capacity ? request->capacity : 1024;
+        while (capacity < request->length + length)
+            capacity *= 2;
+        char *output = realloc(request->output, capacity);
+        if (output == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        request->output = output;
+        request->capacity = capacity;
+    }
+    memcpy(request->output + request->length, data, length);
+    request->length += length;
+}
+
+// Runs every line of path ("-" for stdin) as a command without waiting for
+// each reply: up to window commands are in flight at once, and replies,
+// which may come back in any order, are matched to them by request ID and
+// printed in file order. Returns 0 if every command exited with status 0.
+int run_batch(const char *path, int window)
+{
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (input == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    BatchRequest *requests = NULL;
+    int count = 0, capacity = 0;
+    char line[MAX_CMD_LEN];
+    while (fgets(line, sizeof(line), input) != NULL)
+    {
+        line[strcspn(line, "\n")] = 0;
+        // Blank lines are skipped; EXIT and CHPT only make sense interactively
+        if (line[strspn(line, " \t")] == '\0' || strcmp(line, "EXIT") == 0 || strncmp(line, "CHPT ", 5) == 0)
+            continue;
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            requests = realloc(requests, capacity * sizeof(BatchRequest));
+            if (requests == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        memset(&requests[count], 0, sizeof(BatchRequest));
+        requests[count++].command = strdup(line);
+    }
+    if (input != stdin)
+        fclose(input);
+
+    // Request IDs of the batch are first_id + index
+    int first_id = next_request_id;
+    int sent = 0, printed = 0, failed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (printed < count)
+    {
+        // Sent-but-unprinted requests are bounded, so the server never sits
+        // on more of our replies than we are prepared to read
+        if (sent < count && sent - printed < window)
+        {
+            send_command(requests[sent++].command);
+            continue;
+        }
+
+        if (next_reply_message(&msg) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("msgrcv response");
+            exit(1);
+        }
+        int index = msg.request_id - first_id;
+        if (index < printed || index >= sent || requests[index].done)
+        {
+            fprintf(stderr, "[Main Thread -- %lu] Dropped a reply chunk of request %d\n", pthread_self(), msg.request_id);
+            continue;
+        }
+
+        BatchRequest *request = &requests[index];
+        if (msg.seq != request->expected_seq)
+            fprintf(stderr, "[Main Thread -- %lu] Reply chunk %d of request %d arrived, expected %d\n", pthread_self(), msg.seq, msg.request_id, request->expected_seq);
+        request->expected_seq = msg.seq + 1;
+        batch_append(request, msg.command, msg.length);
+        if (passed_fd != -1)
+        {
+            char buffer[65536];
+            ssize_t n;
+            while ((n = read(passed_fd, buffer, sizeof(buffer))) > 0 || (n == -1 && errno == EINTR))
+            {
+                if (n > 0)
+                    batch_append(request, buffer, n);
+            }
+            close(passed_fd);
+            passed_fd = -1;
+        }
+        if (!(msg.flags & MSG_FLAG_END))
+            continue;
+        request->done = 1;
+        request->status = msg.status;
+
+        for (; printed < count && requests[printed].done; printed++)
+        {
+            BatchRequest *done = &requests[printed];
+            printf("===== [%d] %s", printed + 1, done->command);
+            if (done->status != 0)
+                printf(" (exit status %d)", done->status);
+            printf("\n");
+            fwrite(done->output, 1, done->length, stdout);
+            if (done->length > 0 && done->output[done->length - 1] != '\n')
+                printf("\n");
+            failed += done->status != 0;
+            free(done->output);
+            free(done->command);
+        }
+        fflush(stdout);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "[Main Thread -- %lu]: Batch of %d commands finished in %.1f ms (%d in flight at most), %d failed\n",
+            pthread_self(), count, elapsed_ms, window, failed);
+    free(requests);
+    return failed > 0;
+}
+
+// Runs command, or every line of script ("-" for stdin), one after another
+// with their output streamed to stdout. Returns the exit status of the last
+// one, like sh would.
+int run_script(const char *command, const char *script)
+{
+    if (command != NULL && strlen(command) >= MAX_CMD_LEN)
+    {
+        fprintf(stderr, "Command longer than %d bytes\n", MAX_CMD_LEN - 1);
+        return 1;
+    }
+    if (command != NULL)
+        return receive_response(send_command(command), 0);
+
+    FILE *input = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+    if (input == NULL)
+    {
+        perror(script);
+        return 1;
+    }
+
+    int status = 0;
+    char line[MAX_CMD_LEN];
+    while (fgets(line, sizeof(line), input) != NULL)
+    {
+        line[strcspn(line, "\n")] = 0;
+        const char *start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#' || strncmp(line, "CHPT ", 5) == 0)
+            continue;
+        if (strcmp(line, "EXIT") == 0)
+            break;
+        status = receive_response(send_command(line), 0);
+    }
+    if (input != stdin)
+        fclose(input);
+    return status;
+}
 
-    printf("|################## I am the Parent Process (PID: %d) running this Client #################|\n", getpid());
-    printf("|-------------------------------------------------------------------------------------------|\n");
+void remove_reply_queue(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), CLIENT_REPLY_MQ_NAME, getpid());
+    mq_unlink(name);
+}
 
+// Opens the server's SysV queues and, with use_shm, creates our shared-memory channel
+void open_sysv_transport(int use_shm)
+{
     server_msg_queue = msgget(SERVER_QUEUE_KEY, 0666);
     response_msg_queue = msgget(RESPONSE_QUEUE_KEY, 0666); // Open response queue
     if (server_msg_queue == -1 || response_msg_queue == -1)
@@ -106,24 +482,226 @@ int main()
         perror("msgget");
         exit(1);
     }
-    send_command("REGISTER");
-    sleep(1); // Wait for server to register client
 
-    printf("\n[Main Thread -- %lu]: I am the Client's Main Thread. My Parent Process is (PID: %d)...\n", pthread_self(), getppid());
+    // Drop stale replies left behind for a previous client that had our PID
+    while (msgrcv(response_msg_queue, &msg, sizeof(Message) - sizeof(long), getpid(), IPC_NOWAIT) != -1)
+        ;
+
+    if (use_shm)
+    {
+        channel = shm_channel_create(getpid());
+        if (channel == NULL)
+        {
+            perror("shm_channel_create");
+            exit(1);
+        }
+        atexit(remove_channel);
+        if (interactive)
+            printf("[Main Thread -- %lu]: Using the shared-memory channel '" SHM_CHANNEL_NAME "'\n", pthread_self(), getpid());
+    }
+}
+
+// Creates our reply queue and opens the event-loop server's request queue
+void open_mq_transport(void)
+{
+    char name[64];
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = MQ_MAX_MESSAGES;
+    attr.mq_msgsize = MQ_FRAME_MAX;
 
-    pthread_t shutdown_thread;
-    pthread_create(&shutdown_thread, NULL, listen_for_shutdown, NULL);
-    pthread_detach(shutdown_thread);
-    printf("\n[Main Thread -- %lu]: Created a Child Thread [%lu] for listening to the server's SHUTDOWN broadcast message...\n", pthread_self(), shutdown_thread);
+    snprintf(name, sizeof(name), CLIENT_REPLY_MQ_NAME, getpid());
+    mq_unlink(name); // Left behind by a previous client that had our PID
+    reply_mq = mq_open(name, O_CREAT | O_RDONLY, 0666, &attr);
+    request_mq = mq_open(SERVER_MQ_NAME, O_WRONLY);
+    if (reply_mq == (mqd_t)-1 || request_mq == (mqd_t)-1)
+    {
+        perror("mq_open (is the server running with -E?)");
+        remove_reply_queue();
+        exit(1);
+    }
+    atexit(remove_reply_queue);
+    if (interactive)
+        printf("[Main Thread -- %lu]: Using the POSIX queues '" SERVER_MQ_NAME "' and '%s'\n", pthread_self(), name);
+}
+
+// Connects to the worker-pool server's Unix socket
+void open_unix_transport(void)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SERVER_SOCKET_PATH, sizeof(address.sun_path) - 1);
+
+    server_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (server_socket == -1 || connect(server_socket, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        perror("connect " SERVER_SOCKET_PATH " (is the server running with -U?)");
+        exit(1);
+    }
+    if (interactive)
+        printf("[Main Thread -- %lu]: Using the Unix socket '" SERVER_SOCKET_PATH "'\n", pthread_self());
+}
+
+// Connects to a server's TCP front-end (server -N) at "host:port", where
+// host is an IPv4 or IPv6 address ("[::1]:port") or localhost
+void open_tcp_transport(const char *spec)
+{
+    char host[INET6_ADDRSTRLEN + 2];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || colon == spec || (size_t)(colon - spec) >= sizeof(host) || atoi(colon + 1) < 1 || atoi(colon + 1) > 65535)
+    {
+        fprintf(stderr, "Expected host:port, got '%s'\n", spec);
+        exit(1);
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+    if (host[0] == '[')
+    {
+        memmove(host, host + 1, strlen(host));
+        host[strcspn(host, "]")] = '\0';
+    }
+    if (strcmp(host, "localhost") == 0)
+        strcpy(host, "127.0.0.1");
+
+    struct sockaddr_in ipv4 = {0};
+    struct sockaddr_in6 ipv6 = {0};
+    struct sockaddr *address;
+    socklen_t address_length;
+    if (inet_pton(AF_INET, host, &ipv4.sin_addr) == 1)
+    {
+        ipv4.sin_family = AF_INET;
+        ipv4.sin_port = htons(atoi(colon + 1));
+        address = (struct sockaddr *)&ipv4;
+        address_length = sizeof(ipv4);
+    }
+    else if (inet_pton(AF_INET6, host, &ipv6.sin6_addr) == 1)
+    {
+        ipv6.sin6_family = AF_INET6;
+        ipv6.sin6_port = htons(atoi(colon + 1));
+        address = (struct sockaddr *)&ipv6;
+        address_length = sizeof(ipv6);
+    }
+    else
+    {
+        fprintf(stderr, "Not an IP address: '%s'\n", host);
+        exit(1);
+    }
+
+    int on = 1;
+    server_tcp = socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server_tcp == -1 || connect(server_tcp, address, address_length) == -1)
+    {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(server_tcp, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Requests are small and latency-bound
+    setsockopt(server_tcp, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    if (interactive)
+        printf("[Main Thread -- %lu]: Connected to the server at %s\n", pthread_self(), spec);
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t sysv|shm|mq|unix | --connect host:port] [-c command | -f script | -b command_file [-w window]]\n", prog);
+    fprintf(stderr, "  --connect  talk to a server's TCP front-end (server -N) instead of one on this host\n");
+    fprintf(stderr, "  -c  run command, print its output and exit with its exit status\n");
+    fprintf(stderr, "  -f  run the commands in script (- for stdin) one at a time, same as -c for each\n");
+    fprintf(stderr, "  -b  run the commands in command_file (- for stdin), pipelined, then exit\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    // signal(SIGINT, handle_shutdown);
+    int use_shm = 0;
+    int use_mq = 0;
+    int use_unix = 0;
+    const char *connect_to = NULL;
+    const char *batch_file = NULL;
+    const char *command = NULL;
+    const char *script = NULL;
+    int batch_window = DEFAULT_BATCH_WINDOW;
+    int opt;
+    static const struct option long_options[] = {{"connect", required_argument, NULL, 'C'}, {NULL, 0, NULL, 0}};
+    while ((opt = getopt_long(argc, argv, "t:b:w:c:f:", long_options, NULL)) != -1)
+    {
+        if (opt == 't' && strcmp(optarg, "shm") == 0)
+            use_shm = 1;
+        else if (opt == 't' && strcmp(optarg, "mq") == 0)
+            use_mq = 1;
+        else if (opt == 't' && strcmp(optarg, "unix") == 0)
+            use_unix = 1;
+        else if (opt == 'C')
+            connect_to = optarg;
+        else if (opt == 'b')
+            batch_file = optarg;
+        else if (opt == 'c')
+            command = optarg;
+        else if (opt == 'f')
+            script = optarg;
+        else if (opt == 'w' && atoi(optarg) > 0)
+            batch_window = atoi(optarg);
+        else if (opt != 't' || strcmp(optarg, "sysv") != 0)
+            usage(argv[0]);
+    }
+    if ((batch_file != NULL) + (command != NULL) + (script != NULL) > 1)
+        usage(argv[0]);
+    interactive = batch_file == NULL && command == NULL && script == NULL;
+
+    if (interactive)
+    {
+        printf("|################## I am the Parent Process (PID: %d) running this Client #################|\n", getpid());
+        printf("|-------------------------------------------------------------------------------------------|\n");
+    }
+
+    if (connect_to != NULL)
+        open_tcp_transport(connect_to);
+    else if (use_mq)
+        open_mq_transport();
+    else if (use_unix)
+        open_unix_transport();
+    else
+        open_sysv_transport(use_shm);
+
+    // The ack means the server has set up our broadcast queue (and channel)
+    RegisterAck ack = register_with_server();
+    if (interactive)
+        print_registration(&ack);
+
+    static mqd_t shutdown_mq = (mqd_t)-1;
+    pthread_t shutdown_thread = 0;
+    if (ack.capabilities & CAP_BROADCAST)
+        shutdown_mq = open_shutdown_queue();
+    if (shutdown_mq != (mqd_t)-1)
+    {
+        pthread_create(&shutdown_thread, NULL, listen_for_shutdown, &shutdown_mq);
+        pthread_detach(shutdown_thread);
+    }
+    if (interactive)
+    {
+        printf("\n[Main Thread -- %lu]: I am the Client's Main Thread. My Parent Process is (PID: %d)...\n", pthread_self(), getppid());
+        printf("\n[Main Thread -- %lu]: Created a Child Thread [%lu] for listening to the server's SHUTDOWN broadcast message...\n", pthread_self(), shutdown_thread);
+    }
+
+    if (command != NULL || script != NULL)
+    {
+        int status = run_script(command, script);
+        receive_response(send_command("EXIT"), 1);
+        exit(status);
+    }
+    if (batch_file != NULL)
+    {
+        int rc = run_batch(batch_file, batch_window);
+        receive_response(send_command("EXIT"), 1);
+        exit(rc);
+    }
 
     printf("\n[Main Thread -- %lu]: Client initialized. Enter commands (type 'EXIT' to quit)...\n", pthread_self());
 
-    sleep(1);
     while (1)
     {
         printf("\n%s Enter Command: ", prompt);
         char command[MAX_CMD_LEN];
-        fgets(command, MAX_CMD_LEN, stdin);
+        if (fgets(command, MAX_CMD_LEN, stdin) == NULL)
+            strcpy(command, "EXIT"); // End of input: leave instead of spinning on EOF
         command[strcspn(command, "\n")] = 0;
 
         if (strlen(command) == 0)
@@ -133,9 +711,9 @@ int main()
         }
         else if (strcmp(command, "EXIT") == 0)
         {
-            send_command(command);
+            int request_id = send_command(command);
             printf("Exiting client...\n");
-            receive_response(); // Wait and print response from server
+            receive_response(request_id, 0); // Wait and print response from server
             exit(0);
         }
         else if (strncmp(command, "CHPT ", 5) == 0)
@@ -151,10 +729,15 @@ int main()
             prompt[sizeof(prompt) - 1] = '\0'; // Ensure null termination
             printf("Prompt changed to '%s'\n", prompt);
         }
+        else if (strcmp(command, "REGISTER") == 0)
+        {
+            RegisterAck again = register_with_server();
+            print_registration(&again);
+        }
         else
         {
-            send_command(command);
-            receive_response(); // Wait and print response from server
+            int request_id = send_command(command);
+            receive_response(request_id, 0); // Wait and print response from server
         }
     }
     return 0;
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,31 +9,163 @@
 #include <signal.h>
 #include <mqueue.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
 
-#define MAX_CLIENTS 10
-#define MAX_CMD_LEN 1024
-#define SERVER_QUEUE_KEY 1234
-#define RESPONSE_QUEUE_KEY 5678 // New queue for responses
+#include "protocol.h"
+#include "shm_ring.h"
+#include "spawn.h"
+#include "shell_pool.h"
+#include "client_registry.h"
+#include "output_cache.h"
+#include "single_flight.h"
+#include "reply_outbox.h"
+#include "fair_queue.h"
+#include "command_gate.h"
+#include "uring.h"
+#include "mpmc_ring.h"
+#include "object_pool.h"
 
-typedef struct
-{
-    long msg_type;
-    pid_t client_pid;
-    char command[MAX_CMD_LEN];
-} Message;
+#define DEFAULT_WORKER_THREADS 8
+#define DEFAULT_QUEUE_CAPACITY 256
+#define THREAD_STACK_SIZE (256 * 1024) // Workers and shm intake threads; their deepest frames are a few KB
+#define DEFAULT_COMMAND_TIMEOUT_MS 300000
 
+// Immutable, reference-counted LIST reply for one version of the registry
 typedef struct
 {
-    pid_t pid;
-    int hidden;
-} Client;
+    int refs;
+    unsigned long version;
+    size_t length;
+    char text[];
+} ClientSnapshot;
 
-Client clients[MAX_CLIENTS];
-int client_count = 0;
+ClientRegistry registry;
 int server_msg_queue;
 int response_msg_queue; // Queue for responses
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-void register_client_shutdown(pid_t client_pid)
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // Guards registry and registry_version
+unsigned long registry_version = 1;              // Bumped on every registry change
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER; // Guards published_snapshot only
+ClientSnapshot *published_snapshot = NULL;
+FairQueue request_queue;
+MpmcRing request_ring; // -Q ring: first come, first served instead of request_queue
+int fifo_requests = 0;
+ObjectPool message_pool; // Requests, from an intake thread to the worker that runs them
+ObjectPool command_pool; // EventCommands, from the worker that spawns them to their reactor
+ObjectPool pending_pool; // PendingCommands waiting at the command gate
+pthread_attr_t small_stack;
+int worker_count = DEFAULT_WORKER_THREADS;
+int queue_capacity = DEFAULT_QUEUE_CAPACITY;
+SpawnMode spawn_mode = SPAWN_DIRECT;
+int shell_pool_size = 0;
+int shell_recycle = DEFAULT_SHELL_RECYCLE;
+const char *cache_allow_list = NULL; // Set by -c; the output cache is off without it
+int cache_ttl_ms = DEFAULT_CACHE_TTL_MS;
+int cache_kb = DEFAULT_CACHE_KB;
+int coalesce_commands = 0; // -s: identical commands share one run while it is in flight
+double client_rate = 0;    // -l: requests per second per client, 0 for no limit
+int client_burst = 0;
+CommandGate command_gate;
+int max_running = DEFAULT_MAX_RUNNING; // -j: commands running at once, 0 for no cap
+int wait_slots = DEFAULT_WAIT_SLOTS;
+int wait_ms = DEFAULT_WAIT_MS;
+int command_timeout_ms = DEFAULT_COMMAND_TIMEOUT_MS; // -T: wall-clock limit per command, 0 for none
+
+// Scheduling cost of a request: builtins are cheap next to starting a process
+int request_cost(const Message *msg)
+{
+    static const char *const builtins[] = {"REGISTER", "EXIT", "LIST", "HIDE", "UNHIDE", "exit", NULL};
+    for (int i = 0; builtins[i] != NULL; i++)
+    {
+        if (strcmp(msg->command, builtins[i]) == 0)
+            return 1;
+    }
+    return FAIR_SHELL_COST;
+}
+
+// REGISTER and EXIT always get through, so a throttled client can still leave
+int request_exempt(const Message *msg)
+{
+    return strcmp(msg->command, "REGISTER") == 0 || strcmp(msg->command, "EXIT") == 0;
+}
+
+int send_reply_message(pid_t client_pid, int request_id, int seq, int flags, int status, const char *data, int length);
+
+void refuse_request(const Message *msg, FairPushResult reason)
+{
+    const char *note = "Too many of your requests are queued, try again later.";
+    if (reason == FAIR_RATE_LIMITED)
+        note = "Rate limit exceeded, try again later.";
+    else if (reason == FAIR_NO_MEMORY)
+        note = "Server out of memory, try again later.";
+    send_reply_message(msg->client_pid, msg->request_id, 0, MSG_FLAG_END | MSG_FLAG_INFO, STATUS_TRY_LATER, note, strlen(note));
+}
+
+// Hands msg to the worker pool, unless the client is over its rate or
+// already has its share of the queue waiting
+void queue_request(Message *msg)
+{
+    if (fifo_requests)
+    {
+        // Only the rate limit still applies; there are no per-client queues to hold a share of
+        if (client_rate > 0 && !request_exempt(msg) && fair_queue_admit(&request_queue, msg->client_pid) == FAIR_RATE_LIMITED)
+        {
+            refuse_request(msg, FAIR_RATE_LIMITED);
+            object_pool_put(&message_pool, msg);
+            return;
+        }
+        mpmc_ring_push(&request_ring, msg);
+        return;
+    }
+
+    FairPushResult result = fair_queue_push(&request_queue, msg, request_cost(msg), !request_exempt(msg));
+    if (result == FAIR_QUEUED)
+        return;
+    refuse_request(msg, result);
+    object_pool_put(&message_pool, msg);
+}
+
+void refuse_no_memory(const Message *msg)
+{
+    refuse_request(msg, FAIR_NO_MEMORY);
+}
+
+// Queues a pooled copy of a request the intake thread received on its stack.
+// Returns 0, or -1 with the client told to try later when there was no memory.
+int queue_request_copy(const Message *msg)
+{
+    Message *msg_copy = object_pool_get(&message_pool);
+    if (msg_copy == NULL)
+    {
+        refuse_no_memory(msg);
+        return -1;
+    }
+    *msg_copy = *msg;
+    queue_request(msg_copy);
+    return 0;
+}
+
+void unregister_client_shutdown(pid_t client_pid)
+{
+    char queue_name[64];
+    snprintf(queue_name, sizeof(queue_name), "/client_broadcast_%d", client_pid);
+    mq_unlink(queue_name);
+}
+
+// Returns 0 if the client's broadcast queue exists
+int register_client_shutdown(pid_t client_pid)
 {
     char queue_name[64];
     mqd_t mq;
@@ -52,272 +185,2824 @@ void register_client_shutdown(pid_t client_pid)
     if (mq == (mqd_t)-1)
     {
         perror("mq_open failed");
-        return;
+        return -1;
     }
 
     printf("[Child Thread * %lu]: Registered the Shutdown broadcast message queue '%s'\n", pthread_self(), queue_name);
 
     // Close the queue (server can reopen it when needed)
     mq_close(mq);
+    return 0;
 }
-void register_client(pid_t pid)
+// Fills in ack for a client that is registered once this returns 0 (now or
+// before); returns -1 if it could not be
+int register_client(pid_t pid, RegisterAck *ack)
 {
     pthread_mutex_lock(&lock);
-    if (client_count < MAX_CLIENTS)
+    Client *client = registry_find(&registry, pid);
+    int already = client != NULL;
+    if (!already)
+        client = registry_add(&registry, pid);
+    int added = !already && client != NULL;
+    int total = registry.count;
+    if (client != NULL && fair_queue_track(&request_queue, pid) == -1)
+        perror("fair_queue_track"); // Its requests keep sharing the unregistered senders' flow
+    ack->slot = client != NULL ? (int)(client - registry.clients) + 1 : 0;
+    if (added)
+        __atomic_add_fetch(&registry_version, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+
+    if (already)
+    {
+        printf("[Child Thread * %lu]: Client (PID: %d) is already registered\n", pthread_self(), pid);
+        ack->capabilities |= CAP_BROADCAST;
+    }
+    else if (added)
     {
-        clients[client_count].pid = pid;
-        clients[client_count].hidden = 0;
-        client_count++;
-        printf("\n[Child Thread * %lu]: Registered client (PID: %d) to the client list. Total clients  ---> [%d]\n", pthread_self(), pid, client_count);
-        register_client_shutdown(pid);
+        printf("\n[Child Thread * %lu]: Registered client (PID: %d) to the client list. Total clients  ---> [%d]\n", pthread_self(), pid, total);
+        // Network clients learn of a shutdown from their connection closing
+        if (pid < TCP_CLIENT_ID_BASE && register_client_shutdown(pid) == 0)
+            ack->capabilities |= CAP_BROADCAST;
     }
     else
     {
         printf("[Child Thread]: Client list full. Cannot register PID: %d\n", pid);
+        return -1;
     }
-    pthread_mutex_unlock(&lock);
+    return 0;
 }
 
-void send_response(pid_t client_pid, const char *response)
+// Server end of a client's shared-memory channel. Looked up by PID on every
+// reply; the table and the intake thread each hold a reference.
+typedef struct ShmClient
 {
-    Message msg;
-    msg.msg_type = 1;
-    msg.client_pid = client_pid;
-    strncpy(msg.command, response, sizeof(msg.command) - 1);
-    msg.command[sizeof(msg.command) - 1] = '\0'; // Ensure null-termination
+    pid_t pid;
+    ShmChannel *channel;
+    int refs;
+    pthread_mutex_t send_lock; // Workers take turns so the response ring keeps a single producer
+    struct ShmClient *next;
+} ShmClient;
+
+#define SHM_CLIENT_BUCKETS 256
+#define SHM_POLL_MS 1000 // How often a blocked ring operation checks that the client is alive
 
-    if (msgsnd(response_msg_queue, &msg, sizeof(Message) - sizeof(long), 0) == -1)
-        perror("msgsnd response");
+ShmClient *shm_clients[SHM_CLIENT_BUCKETS];
+int shm_client_count = 0;
+pthread_rwlock_t shm_clients_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+ShmClient *shm_client_get(pid_t pid)
+{
+    if (__atomic_load_n(&shm_client_count, __ATOMIC_ACQUIRE) == 0)
+        return NULL; // Fast path for SysV-only servers
+
+    pthread_rwlock_rdlock(&shm_clients_lock);
+    ShmClient *client = shm_clients[pid % SHM_CLIENT_BUCKETS];
+    while (client != NULL && client->pid != pid)
+        client = client->next;
+    if (client != NULL)
+        __atomic_add_fetch(&client->refs, 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&shm_clients_lock);
+    return client;
 }
-void list_clients(pid_t client_pid)
+
+void shm_client_put(ShmClient *client)
 {
-    pthread_mutex_lock(&lock);
+    if (__atomic_sub_fetch(&client->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        shm_channel_close(client->channel);
+        pthread_mutex_destroy(&client->send_lock);
+        free(client);
+    }
+}
 
-    char full_list[1024] = ""; // Buffer to hold the client list
-    char client_info[1024];    // Buffer for individual client information
+// Unhooks the client's channel so later replies go back to the SysV queue
+void shm_client_detach(pid_t pid)
+{
+    pthread_rwlock_wrlock(&shm_clients_lock);
+    ShmClient **link = &shm_clients[pid % SHM_CLIENT_BUCKETS];
+    while (*link != NULL && (*link)->pid != pid)
+        link = &(*link)->next;
+    ShmClient *client = *link;
+    if (client != NULL)
+    {
+        *link = client->next;
+        shm_client_count--;
+    }
+    pthread_rwlock_unlock(&shm_clients_lock);
 
-    for (int i = 0; i < client_count; i++)
+    if (client != NULL)
     {
-        if (!clients[i].hidden)
-        {
-            snprintf(client_info, sizeof(client_info), "Client %d --> (PID %d)\n", i + 1, clients[i].pid);
-            strcat(full_list, client_info); // Append to the full list string
-        }
+        shm_channel_unlink(pid);
+        shm_client_put(client);
     }
-    send_response(client_pid, full_list);
-    pthread_mutex_unlock(&lock);
 }
-void hide_client(pid_t client_pid)
+
+int client_alive(pid_t pid)
 {
-    pthread_mutex_lock(&lock);
-    for (int i = 0; i < client_count; i++)
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Drains one client's request ring into the worker pool
+void *shm_intake_thread(void *arg)
+{
+    ShmClient *client = arg;
+    Message msg;
+
+    while (1)
     {
-        if (clients[i].pid == client_pid)
+        if (shm_ring_pop(&client->channel->request, &msg, SHM_POLL_MS) == -1)
         {
-            if (clients[i].hidden == 1)
+            if (!client_alive(client->pid))
             {
-                send_response(client_pid, "You Are Already Hidden...");
-                pthread_mutex_unlock(&lock);
-                return;
+                printf("\n[Shm Thread * %lu]: Client (PID %d) went away, dropping its shared-memory channel\n", pthread_self(), client->pid);
+                shm_client_detach(client->pid);
+                break;
             }
-            clients[i].hidden = 1; // Mark client as hidden
-            break;
+            continue;
         }
+
+        msg.client_pid = client->pid; // The ring already identifies the sender
+        printf("\n[Shm Thread * %lu]: Received command '%s' from client (PID: %d). Handing it to the worker pool.\n", pthread_self(), msg.command, msg.client_pid);
+        // The EXIT handler sends the last reply and detaches the channel
+        if (queue_request_copy(&msg) == 0 && strcmp(msg.command, "EXIT") == 0)
+            break;
     }
-    send_response(client_pid, "You Are Now Hidden...");
-    pthread_mutex_unlock(&lock);
+    shm_client_put(client);
+    return NULL;
 }
-void unhide_client(pid_t client_pid)
+
+// Returns 0 once the client's channel is attached (now or before)
+int shm_client_attach(pid_t pid)
 {
-    pthread_mutex_lock(&lock);
-    for (int i = 0; i < client_count; i++)
+    ShmChannel *channel = shm_channel_open(pid);
+    if (channel == NULL)
     {
-        if (clients[i].pid == client_pid)
-        {
-            if (clients[i].hidden == 0)
-            {
-                send_response(client_pid, "You Are Not Hidden At All...");
-                pthread_mutex_unlock(&lock);
-                return;
-            }
-            clients[i].hidden = 0; // Mark client as unhidden
-            break;
-        }
+        perror("shm_channel_open");
+        return -1;
     }
-    send_response(client_pid, "You Are Now Visible Again...");
-    pthread_mutex_unlock(&lock);
+
+    ShmClient *client = malloc(sizeof(ShmClient));
+    if (client == NULL)
+    {
+        perror("shm client");
+        shm_channel_close(channel);
+        return -1;
+    }
+    client->pid = pid;
+    client->channel = channel;
+    client->refs = 2; // Table and intake thread
+    pthread_mutex_init(&client->send_lock, NULL);
+
+    pthread_rwlock_wrlock(&shm_clients_lock);
+    ShmClient *existing = shm_clients[pid % SHM_CLIENT_BUCKETS];
+    while (existing != NULL && existing->pid != pid)
+        existing = existing->next;
+    if (existing == NULL)
+    {
+        client->next = shm_clients[pid % SHM_CLIENT_BUCKETS];
+        shm_clients[pid % SHM_CLIENT_BUCKETS] = client;
+        shm_client_count++;
+    }
+    pthread_rwlock_unlock(&shm_clients_lock);
+
+    if (existing != NULL)
+    {
+        printf("[Child Thread * %lu]: Client (PID %d) already has a shared-memory channel\n", pthread_self(), pid);
+        shm_channel_close(channel);
+        pthread_mutex_destroy(&client->send_lock);
+        free(client);
+        return 0;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, &small_stack, shm_intake_thread, client) != 0)
+    {
+        perror("pthread_create shm intake");
+        shm_client_put(client);
+        shm_client_detach(pid);
+        return -1;
+    }
+    pthread_detach(thread);
+    printf("[Child Thread * %lu]: Client (PID %d) talks to us over the shared-memory channel '" SHM_CHANNEL_NAME "'\n", pthread_self(), pid, pid);
+    return 0;
 }
 
-void *handle_client(void *arg)
+// Puts the reply in the client's shared-memory channel without waiting.
+// Returns 0 if it went in (or was dropped for a dead client), 1 while the
+// ring is full, -1 if the client has no channel.
+int shm_send_reply(pid_t client_pid, const Message *msg)
+{
+    ShmClient *client = shm_client_get(client_pid);
+    if (client == NULL)
+        return -1;
+
+    pthread_mutex_lock(&client->send_lock);
+    int full = shm_ring_push(&client->channel->response, msg, 0) == -1 && client_alive(client_pid);
+    pthread_mutex_unlock(&client->send_lock);
+    shm_client_put(client);
+    return full;
+}
+
+// Server end of a client's connection to the Unix socket (-U). Looked up by
+// PID on every reply; the table and the socket thread share one reference.
+typedef struct SockClient
+{
+    pid_t pid;
+    int fd;
+    int refs;
+    struct SockClient *next;
+} SockClient;
+
+#define SOCK_CLIENT_BUCKETS 256
+
+int listen_socket = 0; // -U: also serve clients on SERVER_SOCKET_PATH
+SockClient *sock_clients[SOCK_CLIENT_BUCKETS];
+int sock_client_count = 0;
+pthread_rwlock_t sock_clients_lock = PTHREAD_RWLOCK_INITIALIZER;
+unsigned long fds_passed = 0; // Commands whose output pipe went straight to the client
+
+SockClient *sock_client_get(pid_t pid)
 {
-    Message msg = *(Message *)arg;
-    free(arg);
+    if (__atomic_load_n(&sock_client_count, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    pthread_rwlock_rdlock(&sock_clients_lock);
+    SockClient *client = sock_clients[pid % SOCK_CLIENT_BUCKETS];
+    while (client != NULL && client->pid != pid)
+        client = client->next;
+    if (client != NULL)
+        __atomic_add_fetch(&client->refs, 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&sock_clients_lock);
+    return client;
+}
 
-    if (strcmp(msg.command, "REGISTER") == 0)
-        register_client(msg.client_pid);
-    else if (strcmp(msg.command, "EXIT") == 0)
+void sock_client_put(SockClient *client)
+{
+    if (__atomic_sub_fetch(&client->refs, 1, __ATOMIC_ACQ_REL) == 0)
     {
-        pthread_mutex_lock(&lock);
-        for (int i = 0; i < client_count; i++)
-        {
-            if (clients[i].pid == msg.client_pid)
-            {
-                for (int j = i; j < client_count - 1; j++)
-                    clients[j] = clients[j + 1]; // Shift remaining clients down
+        close(client->fd);
+        free(client);
+    }
+}
 
-                client_count--;
-                printf("\n[Child Thread * %lu]: Cleaning up client (PID %d) resources...\n", pthread_self(), msg.client_pid);
-                send_response(msg.client_pid, "Client disconnected successfully.");
-                break;
-            }
-        }
-        pthread_mutex_unlock(&lock);
+// Sends the frame over the client's socket without waiting. Returns 0 if it
+// went out (or was dropped for a dead client), 1 while the socket buffer is
+// full, -1 if the client has none.
+int sock_send_reply(pid_t client_pid, const Message *msg, int fd)
+{
+    SockClient *client = sock_client_get(client_pid);
+    if (client == NULL)
+        return -1;
+
+    int rc;
+    while ((rc = sock_send_frame(client->fd, msg, fd, MSG_DONTWAIT)) == -1 && errno == EINTR)
+        ;
+    int full = rc == -1 && errno == EAGAIN && client_alive(client_pid);
+    sock_client_put(client);
+    return full;
+}
+
+// Takes a new connection into the table under the PID the kernel vouches for
+SockClient *sock_client_accept(int listen_fd)
+{
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("accept");
+        return NULL;
     }
-    else if (strcmp(msg.command, "LIST") == 0)
-        list_clients(msg.client_pid);
-    else if (strcmp(msg.command, "HIDE") == 0)
-        hide_client(msg.client_pid);
-    else if (strcmp(msg.command, "UNHIDE") == 0)
-        unhide_client(msg.client_pid);
-    else if (strcmp(msg.command, "exit") == 0)
-        send_response(msg.client_pid, "Ignored 'exit' command as it may Exit ther Shell Session...");
-    else
+    struct ucred peer;
+    socklen_t peer_length = sizeof(peer);
+    SockClient *client = malloc(sizeof(SockClient));
+    if (client == NULL || getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) == -1)
     {
-        // Treat as a shell command
-        int pipefd[2];
-        if (pipe(pipefd) == -1)
-        {
-            perror("pipe");
-            send_response(msg.client_pid, "Error creating pipe.");
-            pthread_exit(NULL);
-        }
+        perror("socket client");
+        free(client);
+        close(fd);
+        return NULL;
+    }
+    client->pid = peer.pid;
+    client->fd = fd;
+    client->refs = 1;
 
-        pid_t pid = fork();
-        if (pid == -1)
-        {
-            perror("fork");
-            send_response(msg.client_pid, "Error forking process.");
-        }
-        else if (pid == 0)
-        {
-            // Child process: Redirect stdout to pipe and execute shell command
-            close(pipefd[0]); // Close read end
-            dup2(pipefd[1], STDOUT_FILENO);
-            dup2(pipefd[1], STDERR_FILENO);
-            close(pipefd[1]);
+    pthread_rwlock_wrlock(&sock_clients_lock);
+    SockClient *existing = sock_clients[peer.pid % SOCK_CLIENT_BUCKETS];
+    while (existing != NULL && existing->pid != peer.pid)
+        existing = existing->next;
+    if (existing == NULL)
+    {
+        client->next = sock_clients[peer.pid % SOCK_CLIENT_BUCKETS];
+        sock_clients[peer.pid % SOCK_CLIENT_BUCKETS] = client;
+        sock_client_count++;
+    }
+    pthread_rwlock_unlock(&sock_clients_lock);
 
-            // execvp("/bin/bash", "bash", "-c", msg.command, NULL);
-            char *args[] = {"/bin/bash", "-c", msg.command, NULL};
-            execvp(args[0], args);
+    if (existing != NULL)
+    {
+        printf("[Socket Thread * %lu]: Client (PID %d) is already connected, refusing a second connection\n", pthread_self(), peer.pid);
+        close(fd);
+        free(client);
+        return NULL;
+    }
+    printf("\n[Socket Thread * %lu]: Client (PID %d) connected over '" SERVER_SOCKET_PATH "'\n", pthread_self(), peer.pid);
+    return client;
+}
 
-            exit(1);
-        }
-        else
-        {
-            // Parent process: Read command output and send response
-            close(pipefd[1]); // Close write end
+void sock_client_detach(SockClient *client)
+{
+    pthread_rwlock_wrlock(&sock_clients_lock);
+    SockClient **link = &sock_clients[client->pid % SOCK_CLIENT_BUCKETS];
+    while (*link != client)
+        link = &(*link)->next;
+    *link = client->next;
+    sock_client_count--;
+    pthread_rwlock_unlock(&sock_clients_lock);
+    sock_client_put(client);
+}
 
-            char buffer[55024];
-            ssize_t bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1);
-            close(pipefd[0]);
+// Accepts clients on SERVER_SOCKET_PATH and hands their requests to the
+// worker pool; replies go out from the workers through sock_send_reply()
+void *socket_thread(void *arg)
+{
+    int listen_fd = *(int *)arg;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {EPOLLIN, {.ptr = NULL}}; // NULL stands for the listening socket
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1)
+    {
+        perror("socket epoll");
+        return NULL;
+    }
 
-            if (bytes_read > 0)
+    struct epoll_event events[64];
+    while (1)
+    {
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        for (int i = 0; i < ready; i++)
+        {
+            SockClient *client = events[i].data.ptr;
+            if (client == NULL)
             {
-                buffer[bytes_read] = '\0'; // Null-terminate output
-                send_response(msg.client_pid, buffer);
+                client = sock_client_accept(listen_fd);
+                struct epoll_event watch = {EPOLLIN, {.ptr = client}};
+                if (client != NULL && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &watch) == -1)
+                {
+                    perror("epoll_ctl socket client");
+                    sock_client_detach(client);
+                }
+                continue;
             }
-            else
+
+            Message msg;
+            int fd;
+            while (sock_recv_frame(client->fd, &msg, &fd, MSG_DONTWAIT) == 0)
             {
-                send_response(msg.client_pid, "Command executed, but no output.");
+                if (fd != -1)
+                    close(fd); // Clients have no business passing us descriptors
+                msg.client_pid = client->pid; // The connection already identifies the sender
+                printf("\n[Socket Thread * %lu]: Received command '%s' from client (PID: %d). Handing it to the worker pool.\n", pthread_self(), msg.command, msg.client_pid);
+                queue_request_copy(&msg);
             }
-
-            waitpid(pid, NULL, 0); // Wait for child process
+            if (errno == EAGAIN || errno == EBADMSG)
+                continue;
+            if (errno != ECONNRESET)
+                perror("recvmsg");
+            printf("\n[Socket Thread * %lu]: Client (PID %d) hung up, dropping its connection\n", pthread_self(), client->pid);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+            sock_client_detach(client);
         }
     }
-    pthread_exit(NULL); // Exit the child thread
+    return NULL;
 }
 
-void send_shutdown_signal(pid_t client_pid)
+int socket_listen(void)
 {
-    char queue_name[64];
-    mqd_t mq;
-
-    snprintf(queue_name, sizeof(queue_name), "/client_broadcast_%d", client_pid);
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SERVER_SOCKET_PATH, sizeof(address.sun_path) - 1);
 
-    // Open the queue for writing
-    mq = mq_open(queue_name, O_WRONLY);
-    if (mq == (mqd_t)-1)
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    unlink(SERVER_SOCKET_PATH); // Left behind by a server that did not shut down cleanly
+    if (fd == -1 || bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1)
     {
-        perror("mq_open failed");
-        return;
+        perror("socket " SERVER_SOCKET_PATH);
+        return -1;
     }
+    chmod(SERVER_SOCKET_PATH, 0666); // Same access as the SysV queues
+    return fd;
+}
 
-    // Send shutdown message
-    const char *shutdown_msg = "SHUTDOWN";
-    mq_send(mq, shutdown_msg, strlen(shutdown_msg), 0);
+// Server end of a network client's connection (-N). Frames from several
+// threads must not interleave on the stream, so sends take send_lock, and a
+// frame the socket only took part of is finished before any other; a send
+// that fails shuts the connection down, since the stream can no longer be
+// parsed. The table and the TCP thread share one reference.
+typedef struct TcpClient
+{
+    pid_t id; // TCP_CLIENT_ID_BASE and up, used wherever a PID would be
+    int fd;
+    int refs;
+    pthread_mutex_t send_lock;
+    char output[TCP_FRAME_SIZE_MAX]; // Rest of a frame the socket had no room for
+    size_t output_length;
+    size_t output_sent;
+    char input[TCP_FRAME_SIZE_MAX]; // Start of a frame still arriving
+    size_t input_length;
+    int registered; // Sent REGISTER and not EXIT yet, so a hang-up has to EXIT for it
+    struct TcpClient *next;
+} TcpClient;
 
-    mq_close(mq);
+#define TCP_CLIENT_BUCKETS 256
+#define TCP_KEEPALIVE_IDLE 30    // Seconds of silence before probing a connection
+#define TCP_KEEPALIVE_INTERVAL 10
+#define TCP_KEEPALIVE_PROBES 3
+
+const char *tcp_address = NULL; // -N: [host:]port to serve network clients on
+int tcp_epoll_fd = -1;
+TcpClient *tcp_clients[TCP_CLIENT_BUCKETS];
+int tcp_client_count = 0;
+pthread_rwlock_t tcp_clients_lock = PTHREAD_RWLOCK_INITIALIZER;
+pid_t next_tcp_id = TCP_CLIENT_ID_BASE;
+unsigned long tcp_connections = 0;
+unsigned long tcp_dropped = 0; // Connections shut down on a failed send
+
+TcpClient *tcp_client_get(pid_t id)
+{
+    pthread_rwlock_rdlock(&tcp_clients_lock);
+    TcpClient *client = tcp_clients[id % TCP_CLIENT_BUCKETS];
+    while (client != NULL && client->id != id)
+        client = client->next;
+    if (client != NULL)
+        __atomic_add_fetch(&client->refs, 1, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&tcp_clients_lock);
+    return client;
 }
-void shutdown_server(int signo)
+
+void tcp_client_put(TcpClient *client)
 {
-    printf("----------------------------------------------------------------------------------------------------------\n");
-    printf("[Main Thread -- %lu]: Signal 2 received...\n", pthread_self());
-    printf("[Main Thread -- %lu]: Grecefully exiting...\n", pthread_self());
-    printf("[Main Thread -- %lu]: Cleaning up server and client resources...\n", pthread_self());
-    printf("[Main Thread -- %lu]: Broadcasting 'SHUTDOWN' message to all the clients...\n", pthread_self());
-    pthread_mutex_lock(&lock);
-    for (int i = 0; i < client_count; i++)
-        send_shutdown_signal(clients[i].pid);
+    if (__atomic_sub_fetch(&client->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(client->fd);
+        pthread_mutex_destroy(&client->send_lock);
+        free(client);
+    }
+}
 
-    pthread_mutex_unlock(&lock);
+// Sends what is left of the frame in client->output; returns 0 once it is
+// all out, 1 while the socket is full, -1 if the connection failed
+int tcp_client_flush(TcpClient *client)
+{
+    while (client->output_sent < client->output_length)
+    {
+        ssize_t n = send(client->fd, client->output + client->output_sent, client->output_length - client->output_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return 1;
+        if (n == -1)
+            return -1;
+        client->output_sent += n;
+    }
+    client->output_length = client->output_sent = 0;
+    return 0;
+}
 
-    msgctl(server_msg_queue, IPC_RMID, NULL);
-    msgctl(response_msg_queue, IPC_RMID, NULL);
-    printf("[Main Thread -- %lu]: Shutting down...\n", pthread_self());
-    exit(0);
+// Watches for room to finish a half-sent frame, or stops once it is out
+void tcp_client_want_output(TcpClient *client, int want)
+{
+    struct epoll_event watch = {EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0), {.ptr = client}};
+    epoll_ctl(tcp_epoll_fd, EPOLL_CTL_MOD, client->fd, &watch); // ENOENT once the TCP thread dropped it
 }
 
-int main()
+// Sends a frame to the network client it is addressed to without waiting.
+// Returns 0 once the socket has taken it (a part it had no room for yet is
+// finished by the TCP thread), or it was dropped; 1 while the socket is
+// still busy with an earlier frame, so the reply waits in the outbox and the
+// command's output pauses until a slow reader catches up. Frames for a
+// client that has gone are dropped: there is nowhere else to send them.
+int tcp_send_reply(const Message *msg)
 {
-    signal(SIGINT, shutdown_server);
+    TcpClient *client = tcp_client_get(msg->client_pid);
+    if (client == NULL)
+        return 0;
 
-    printf("|################### I am the PARENT PROCESS (PID: %d) running this SERVER ##################|\n", getpid());
-    printf("|---------------------------------------------------------------------------------------------|\n");
+    pthread_mutex_lock(&client->send_lock);
+    int rc = tcp_client_flush(client);
+    if (rc == 0)
+    {
+        ssize_t length = tcp_frame_encode(msg, client->output);
+        client->output_length = length > 0 ? length : 0;
+        if (tcp_client_flush(client) == 1)
+            tcp_client_want_output(client, 1);
+        else if (client->output_length > 0)
+            rc = -1;
+    }
+    if (rc == -1)
+    {
+        // The TCP thread sees the connection close and cleans up after it
+        shutdown(client->fd, SHUT_RDWR);
+        client->output_length = client->output_sent = 0;
+        __atomic_add_fetch(&tcp_dropped, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&client->send_lock);
+    tcp_client_put(client);
+    return rc == 1;
+}
 
-    printf("\n[Main Thread -- %lu]: I am the Server's Main Thread. My Parent Process is (PID: %d)...\n", pthread_self(), getppid());
+TcpClient *tcp_client_accept(int listen_fd)
+{
+    struct sockaddr_in6 peer;
+    socklen_t peer_length = sizeof(peer);
+    int fd = accept4(listen_fd, (struct sockaddr *)&peer, &peer_length, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("accept");
+        return NULL;
+    }
 
-    server_msg_queue = msgget(SERVER_QUEUE_KEY, IPC_CREAT | 0666);
-    response_msg_queue = msgget(RESPONSE_QUEUE_KEY, IPC_CREAT | 0666); // Create response queue
-    if (server_msg_queue == -1 || response_msg_queue == -1)
+    // Keepalive finds peers that vanished without closing (a crashed host, a
+    // pulled cable), which would otherwise stay registered forever
+    int on = 1, idle = TCP_KEEPALIVE_IDLE, interval = TCP_KEEPALIVE_INTERVAL, probes = TCP_KEEPALIVE_PROBES;
+    TcpClient *client = calloc(1, sizeof(TcpClient));
+    if (client == NULL || setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes)) == -1 ||
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
     {
-        perror("msgget");
-        exit(1);
+        perror("tcp client");
+        free(client);
+        close(fd);
+        return NULL;
     }
+    client->id = next_tcp_id++;
+    client->fd = fd;
+    client->refs = 1;
+    pthread_mutex_init(&client->send_lock, NULL);
 
-    printf("[Main Thread -- %lu]: Broadcast message queue & Server message queue created. Waiting for the client messages...\n", pthread_self());
+    pthread_rwlock_wrlock(&tcp_clients_lock);
+    client->next = tcp_clients[client->id % TCP_CLIENT_BUCKETS];
+    tcp_clients[client->id % TCP_CLIENT_BUCKETS] = client;
+    tcp_client_count++;
+    tcp_connections++;
+    pthread_rwlock_unlock(&tcp_clients_lock);
+
+    char address[INET6_ADDRSTRLEN] = "?";
+    if (peer.sin6_family == AF_INET)
+        inet_ntop(AF_INET, &((struct sockaddr_in *)&peer)->sin_addr, address, sizeof(address));
+    else
+        inet_ntop(AF_INET6, &peer.sin6_addr, address, sizeof(address));
+    printf("\n[TCP Thread * %lu]: Connection %d from %s:%d\n", pthread_self(), client->id - TCP_CLIENT_ID_BASE + 1, address,
+           ntohs(peer.sin6_port));
+    return client;
+}
+
+// Unhooks a connection that closed. A client that registered and never sent
+// EXIT gets one on its behalf, so it leaves LIST like any other client.
+void tcp_client_detach(TcpClient *client)
+{
+    pthread_rwlock_wrlock(&tcp_clients_lock);
+    TcpClient **link = &tcp_clients[client->id % TCP_CLIENT_BUCKETS];
+    while (*link != client)
+        link = &(*link)->next;
+    *link = client->next;
+    tcp_client_count--;
+    pthread_rwlock_unlock(&tcp_clients_lock);
+
+    if (client->registered)
+    {
+        Message *exit_msg = object_pool_get(&message_pool);
+        if (exit_msg != NULL)
+        {
+            memset(exit_msg, 0, sizeof(Message));
+            exit_msg->msg_type = 1;
+            exit_msg->client_pid = client->id;
+            strcpy(exit_msg->command, "EXIT");
+            exit_msg->length = strlen(exit_msg->command);
+            queue_request(exit_msg);
+        }
+    }
+    tcp_client_put(client);
+}
 
+// Reads what the client has sent and queues every complete frame; returns -1
+// once the connection is done with
+int tcp_client_read(TcpClient *client)
+{
     while (1)
     {
+        ssize_t n = recv(client->fd, client->input + client->input_length, sizeof(client->input) - client->input_length, MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return 0;
+        if (n <= 0)
+        {
+            if (n == -1 && errno != ECONNRESET)
+                perror("recv");
+            return -1;
+        }
+        client->input_length += n;
+
         Message msg;
-        if (msgrcv(server_msg_queue, &msg, sizeof(Message) - sizeof(long), 0, 0) == -1)
+        ssize_t used;
+        size_t offset = 0;
+        while ((used = tcp_frame_decode(client->input + offset, client->input_length - offset, &msg)) > 0)
         {
-            perror("msgrcv");
-            continue;
+            offset += used;
+            msg.client_pid = client->id; // The connection identifies the sender
+            if (strcmp(msg.command, "REGISTER") == 0)
+                client->registered = 1;
+            else if (strcmp(msg.command, "EXIT") == 0)
+                client->registered = 0;
+            printf("\n[TCP Thread * %lu]: Received command '%s' from connection %d. Handing it to the worker pool.\n", pthread_self(),
+                   msg.command, client->id - TCP_CLIENT_ID_BASE + 1);
+            queue_request_copy(&msg);
         }
+        if (used == -1)
+        {
+            fprintf(stderr, "[TCP Thread * %lu]: Connection %d sent something other than frames, closing it\n", pthread_self(),
+                    client->id - TCP_CLIENT_ID_BASE + 1);
+            return -1;
+        }
+        memmove(client->input, client->input + offset, client->input_length - offset);
+        client->input_length -= offset;
+    }
+}
 
-        printf("\n[Main Thread -- %lu]: Received command '%s' from client (PID: %d). About to create a child thread.\n", pthread_self(), msg.command, msg.client_pid);
+// Serves network clients from one epoll instance; replies go out from the
+// workers through tcp_send_reply()
+void *tcp_thread(void *arg)
+{
+    int listen_fd = *(int *)arg;
+    int epoll_fd = tcp_epoll_fd;
+    struct epoll_event event = {EPOLLIN, {.ptr = NULL}}; // NULL stands for the listening socket
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1)
+    {
+        perror("tcp epoll");
+        return NULL;
+    }
 
-        pthread_t thread;
-        Message *msg_copy = malloc(sizeof(Message));
-        *msg_copy = msg;
-        pthread_create(&thread, NULL, handle_client, msg_copy);
+    struct epoll_event events[64];
+    while (1)
+    {
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        for (int i = 0; i < ready; i++)
+        {
+            TcpClient *client = events[i].data.ptr;
+            if (client == NULL)
+            {
+                client = tcp_client_accept(listen_fd);
+                struct epoll_event watch = {EPOLLIN | EPOLLRDHUP, {.ptr = client}};
+                if (client != NULL && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &watch) == -1)
+                {
+                    perror("epoll_ctl tcp client");
+                    tcp_client_detach(client);
+                }
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                pthread_mutex_lock(&client->send_lock);
+                int rc = client->output_length > 0 ? tcp_client_flush(client) : 0;
+                if (rc == 0)
+                    tcp_client_want_output(client, 0);
+                else if (rc == -1)
+                    shutdown(client->fd, SHUT_RDWR); // Read below as the connection closing
+                pthread_mutex_unlock(&client->send_lock);
+                if (!(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    continue;
+            }
+            if (tcp_client_read(client) == 0)
+                continue;
+            printf("\n[TCP Thread * %lu]: Connection %d closed\n", pthread_self(), client->id - TCP_CLIENT_ID_BASE + 1);
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+            tcp_client_detach(client);
+        }
+    }
+    return NULL;
+}
 
-        printf("[Main Thread -- %lu]: Successfully created the child thread [%lu]\n", pthread_self(), thread);
+// Listens on "[host:]port"; host is an IPv4 or IPv6 address, 127.0.0.1 by default
+int tcp_listen(const char *spec)
+{
+    char host[INET6_ADDRSTRLEN] = "";
+    const char *colon = strrchr(spec, ':');
+    int port = atoi(colon != NULL ? colon + 1 : spec);
+    if (colon != NULL && (size_t)(colon - spec) < sizeof(host))
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+    if (host[0] == '[') // [::1]:port
+    {
+        memmove(host, host + 1, strlen(host));
+        host[strcspn(host, "]")] = '\0';
+    }
 
-        pthread_detach(thread);
+    // Whoever reaches the port can run commands, so other hosts only get in when asked for by address
+    if (host[0] == '\0')
+        strcpy(host, "127.0.0.1");
 
-        printf("[Main Thread -- %lu]: The child thread [ %lu ] successfully exited\n", pthread_self(), thread);
+    struct sockaddr_in6 address = {0};
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(port);
+    struct in_addr ipv4;
+    if (inet_pton(AF_INET, host, &ipv4) == 1)
+    {
+        // As an IPv4-mapped address, so one socket type does for both
+        address.sin6_addr.s6_addr[10] = 0xff;
+        address.sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&address.sin6_addr.s6_addr[12], &ipv4, sizeof(ipv4));
     }
+    else if (inet_pton(AF_INET6, host, &address.sin6_addr) != 1)
+    {
+        fprintf(stderr, "Not an IP address: '%s'\n", host);
+        return -1;
+    }
+    if (port < 1 || port > 65535)
+    {
+        fprintf(stderr, "Not a port: '%s'\n", spec);
+        return -1;
+    }
+
+    int on = 1, off = 0;
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ||
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == -1 ||
+        bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1)
+    {
+        perror("tcp listen");
+        return -1;
+    }
+    if (!IN6_IS_ADDR_LOOPBACK(&address.sin6_addr) && !(IN6_IS_ADDR_V4MAPPED(&address.sin6_addr) && address.sin6_addr.s6_addr[12] == 127))
+        printf("[Main Thread -- %lu]: WARNING: TCP '%s' is reachable from other hosts, and its clients run shell commands unauthenticated\n", pthread_self(), spec);
+    return fd;
+}
+
+// Kinds of file descriptor watched by the epoll loops: the event-loop core
+// (-E), which runs everything on one thread, and the reactors that supervise
+// running commands for either core
+typedef enum
+{
+    EVENT_REQUESTS,    // SERVER_MQ_NAME has requests
+    EVENT_SIGNALS,     // signalfd for SIGINT, SIGTERM and SIGCHLD
+    EVENT_OUTPUT,      // A command's stdout pipe is readable or closed
+    EVENT_EXIT,        // A command's pidfd: the child has exited
+    EVENT_HANDOFF,     // A reactor's eventfd: commands were handed over, or children exited
+    EVENT_TIMEOUT,     // A command's timerfd: it has run for command_timeout_ms
+    EVENT_REPLY_QUEUE  // A client's full reply queue has room again
+} EventKind;
+
+// Registered as epoll_event.data.ptr, so each event leads back to its owner
+typedef struct
+{
+    EventKind kind;
+    void *owner;
+    int armed; // io_uring: an operation for it is in flight
+} EventSource;
+
+// A reply frame waiting for room in its client's queue
+typedef struct PendingFrame
+{
+    struct PendingFrame *next;
+    Message frame; // Only the used part of command is allocated
+} PendingFrame;
+
+// Reply side of a client of the event-loop core. Only the loop thread
+// touches these, so unlike ShmClient they need no lock.
+typedef struct MqClient
+{
+    struct MqClient *next; // Hash chain
+    pid_t pid;
+    mqd_t reply_mq; // CLIENT_REPLY_MQ_NAME, opened non-blocking
+    PendingFrame *outbox_head;
+    PendingFrame *outbox_tail;
+    int outbox_length;
+    int closing; // EXIT seen, close once the outbox drains
+    EventSource source;
+} MqClient;
+
+#define MQ_CLIENT_BUCKETS 256
+
+int event_core = 0;
+int event_fd = -1; // The event loop's epoll instance, shared with its reactor
+MqClient *mq_clients[MQ_CLIENT_BUCKETS];
+unsigned long mq_frames_deferred = 0; // Replies that found their queue full
+unsigned long mq_frames_dropped = 0;  // ... and then found no memory to wait in the outbox
+mqd_t request_mq = (mqd_t)-1;
+unsigned long event_requests = 0;
+
+void event_watch(int epoll_fd, int fd, uint32_t events, EventSource *source)
+{
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        perror("epoll_ctl add");
+}
+
+void event_unwatch(int epoll_fd, int fd)
+{
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1)
+        perror("epoll_ctl del");
+}
+
+MqClient *mq_client_find(pid_t pid)
+{
+    MqClient *client = mq_clients[(unsigned)pid % MQ_CLIENT_BUCKETS];
+    while (client != NULL && client->pid != pid)
+        client = client->next;
+    return client;
+}
+
+// Opens the reply queue the client created before it sent REGISTER
+void mq_client_attach(pid_t pid)
+{
+    if (mq_client_find(pid) != NULL)
+        return;
+
+    char name[64];
+    snprintf(name, sizeof(name), CLIENT_REPLY_MQ_NAME, pid);
+    mqd_t reply_mq = mq_open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (reply_mq == (mqd_t)-1)
+    {
+        perror("mq_open reply queue");
+        return;
+    }
+
+    MqClient *client = calloc(1, sizeof(MqClient));
+    if (client == NULL)
+    {
+        mq_close(reply_mq);
+        return;
+    }
+    client->pid = pid;
+    client->reply_mq = reply_mq;
+    client->source.kind = EVENT_REPLY_QUEUE;
+    client->source.owner = client;
+
+    MqClient **bucket = &mq_clients[(unsigned)pid % MQ_CLIENT_BUCKETS];
+    client->next = *bucket;
+    *bucket = client;
+}
+
+void mq_client_free(MqClient *client)
+{
+    MqClient **link = &mq_clients[(unsigned)client->pid % MQ_CLIENT_BUCKETS];
+    while (*link != client)
+        link = &(*link)->next;
+    *link = client->next;
+
+    if (client->outbox_head != NULL)
+        event_unwatch(event_fd, client->reply_mq);
+    while (client->outbox_head != NULL)
+    {
+        PendingFrame *pending = client->outbox_head;
+        client->outbox_head = pending->next;
+        free(pending);
+    }
+    mq_close(client->reply_mq);
+    free(client);
+}
+
+// Frees the client now, or after its last queued reply went out. A client
+// is only watched while its outbox is non-empty, so freeing one with an
+// empty outbox cannot leave an event for it pending in the current batch.
+void mq_client_detach(pid_t pid)
+{
+    MqClient *client = mq_client_find(pid);
+    if (client == NULL)
+        return;
+    if (client->outbox_head == NULL)
+        mq_client_free(client);
+    else
+        client->closing = 1;
+}
+
+// Frames waiting in the client's outbox, 0 when it is keeping up
+int mq_client_backlog(pid_t pid)
+{
+    MqClient *client = mq_client_find(pid);
+    return client != NULL ? client->outbox_length : 0;
+}
+
+// Moves queued replies into the client's queue until it is full again;
+// returns how many frames are still waiting
+int mq_client_flush(MqClient *client)
+{
+    while (client->outbox_head != NULL)
+    {
+        PendingFrame *pending = client->outbox_head;
+        if (mq_send_frame(client->reply_mq, &pending->frame) == -1)
+        {
+            if (errno == EAGAIN)
+                return client->outbox_length; // Still full, keep waiting for EPOLLOUT
+            perror("mq_send reply");
+        }
+        client->outbox_head = pending->next;
+        client->outbox_length--;
+        free(pending);
+    }
+    client->outbox_tail = NULL;
+    event_unwatch(event_fd, client->reply_mq);
+    if (client->closing)
+        mq_client_free(client);
+    return 0;
+}
+
+// Sends a reply frame without blocking the event loop: when the client's
+// queue is full the frame waits in its outbox, in order, until epoll says
+// there is room. The outbox has no limit; the reactor stops reading the
+// output of the client's commands once it holds OUTBOX_HIGH_WATER frames.
+int mq_send_reply(const Message *frame)
+{
+    MqClient *client = mq_client_find(frame->client_pid);
+    if (client == NULL)
+        return 0; // Never registered, or gone: nobody to tell
+
+    if (client->outbox_head == NULL)
+    {
+        if (mq_send_frame(client->reply_mq, frame) == 0)
+            return 0;
+        if (errno != EAGAIN)
+        {
+            perror("mq_send reply");
+            return -1;
+        }
+    }
+
+    mq_frames_deferred++;
+    size_t size = offsetof(PendingFrame, frame) + sizeof(long) + MSG_FRAME_SIZE(frame->length);
+    PendingFrame *pending = malloc(size);
+    if (pending == NULL)
+    {
+        mq_frames_dropped++;
+        return -1;
+    }
+    memcpy(&pending->frame, frame, size - offsetof(PendingFrame, frame));
+    pending->next = NULL;
+    if (client->outbox_head == NULL)
+    {
+        client->outbox_head = pending;
+        event_watch(event_fd, client->reply_mq, EPOLLOUT, &client->source);
+    }
+    else
+        client->outbox_tail->next = pending;
+    client->outbox_tail = pending;
+    client->outbox_length++;
+    return 0;
+}
+
+// Tries to send one frame over the client's TCP connection, Unix socket,
+// shared-memory channel, or the response queue, without waiting for room
+// (the reply outbox's OutboxSendFn)
+int send_reply_now(const Message *frame)
+{
+    if (frame->client_pid >= TCP_CLIENT_ID_BASE)
+        return tcp_send_reply(frame);
+    int rc = sock_send_reply(frame->client_pid, frame, -1);
+    if (rc == -1)
+        rc = shm_send_reply(frame->client_pid, frame);
+    if (rc != -1)
+        return rc;
+    if (msg_send_frame(response_msg_queue, frame, IPC_NOWAIT) == 0)
+        return 0;
+    if (errno == EAGAIN)
+        return client_alive(frame->client_pid); // Dropped once nobody will read it
+    perror("msgsnd response");
+    return -1;
+}
+
+// Sends one frame over the client's POSIX reply queue (event-loop core), or
+// through the reply outbox over whichever transport the client uses
+int send_reply_frame(void *ctx, const Message *frame)
+{
+    (void)ctx;
+    if (event_core)
+        return mq_send_reply(frame);
+    return reply_outbox_send(frame);
+}
+
+// Sends a reply payload of any length, split into as many frames as it
+// takes; returns how many sequence numbers it used, or -1 if a frame could
+// not be sent (and the rest were not tried)
+int send_reply_message(pid_t client_pid, int request_id, int seq, int flags, int status, const char *data, int length)
+{
+    Message header;
+    header.msg_type = client_pid; // Address the reply to its client so it only wakes that client
+    header.client_pid = client_pid;
+    header.request_id = request_id;
+    header.seq = seq;
+    header.flags = flags;
+    header.status = status;
+
+    return msg_send_fragmented(&header, data, length, send_reply_frame, NULL);
+}
+
+// One-shot reply to request: a single message that also ends the stream
+void send_response(const Message *request, const char *response)
+{
+    send_reply_message(request->client_pid, request->request_id, 0, MSG_FLAG_END, 0, response, strlen(response));
+}
+// Answers REGISTER over the queue it arrived on. A client asking for a
+// shared-memory channel (MSG_FLAG_SHM) learns from the ack whether it got
+// one, so it waits for the ack on the response queue, not on the ring.
+void send_register_ack(const Message *request, int status, const RegisterAck *ack)
+{
+    if (event_core || !(request->flags & MSG_FLAG_SHM))
+    {
+        send_reply_message(request->client_pid, request->request_id, 0, MSG_FLAG_END | MSG_FLAG_INFO, status, (const char *)ack, sizeof(RegisterAck));
+        return;
+    }
+
+    Message frame;
+    frame.msg_type = request->client_pid;
+    frame.client_pid = request->client_pid;
+    frame.request_id = request->request_id;
+    frame.seq = 0;
+    frame.flags = MSG_FLAG_END | MSG_FLAG_INFO;
+    frame.status = status;
+    frame.length = sizeof(RegisterAck);
+    memcpy(frame.command, ack, sizeof(RegisterAck));
+    if (msg_send_frame(response_msg_queue, &frame, 0) == -1)
+        perror("msgsnd register ack");
+}
+
+// Sequenced reply chunks for one command, ended by reply_stream_end()
+typedef struct
+{
+    pid_t client_pid;
+    int request_id;
+    int seq;
+    OutputCapture *capture; // Set while the output may go into the cache
+    Flight *flight;         // Set while identical requests may join this run
+    int lost;               // A frame could not be sent, so the end says the output is incomplete
+    long deadline_ms;       // Shell pool: when the command's time is up, 0 for never
+} ReplyStream;
+
+// Reply frames the client has waiting for room, whatever its transport
+int reply_backlog(pid_t client_pid)
+{
+    return event_core ? mq_client_backlog(client_pid) : reply_outbox_backlog(client_pid);
+}
+
+// The largest backlog among the clients the stream's output goes to
+int reply_stream_backlog(ReplyStream *stream)
+{
+    int backlog = reply_backlog(stream->client_pid);
+    int passengers = stream->flight != NULL ? single_flight_backlog(stream->flight) : 0;
+    return backlog > passengers ? backlog : passengers;
+}
+
+// A joined request's backlog, for the flight its leader runs
+int joined_stream_backlog(void *ctx)
+{
+    ReplyStream *stream = ctx;
+    return reply_backlog(stream->client_pid);
+}
+
+void reply_stream_write(void *ctx, const char *data, int length)
+{
+    ReplyStream *stream = ctx;
+    if (length > 0)
+    {
+        int frames = send_reply_message(stream->client_pid, stream->request_id, stream->seq, 0, 0, data, length);
+        if (frames == -1)
+        {
+            // Numbered as if sent, so the client sees the gap as well as the status
+            stream->lost = 1;
+            frames = (length + MAX_CMD_LEN - 1) / MAX_CMD_LEN;
+        }
+        stream->seq += frames;
+    }
+    if (length > 0 && stream->capture != NULL)
+        output_capture_append(stream->capture, data, length);
+    if (length > 0 && stream->flight != NULL)
+        single_flight_publish(stream->flight, data, length);
+}
+
+// End-of-stream marker carrying the exit status
+void reply_stream_end(ReplyStream *stream, int exit_status)
+{
+    if (stream->capture != NULL)
+    {
+        output_capture_finish(stream->capture, exit_status);
+        stream->capture = NULL;
+    }
+
+    const char *note = stream->seq == 0 ? "Command executed, but no output." : "";
+    if (stream->lost)
+    {
+        exit_status = STATUS_OUTPUT_LOST;
+        note = "Some of the command's output could not be sent.";
+    }
+    else if (exit_status == STATUS_TIMED_OUT)
+        note = "Command timed out and was killed.";
+    else if (exit_status == STATUS_TRY_LATER)
+        note = "Server busy, try again later."; // A flight that never ran, for its passengers
+    int flags = note[0] != '\0' ? MSG_FLAG_END | MSG_FLAG_INFO : MSG_FLAG_END;
+    send_reply_message(stream->client_pid, stream->request_id, stream->seq, flags, exit_status, note, strlen(note));
+    if (stream->flight != NULL)
+    {
+        single_flight_land(stream->flight, exit_status);
+        stream->flight = NULL;
+    }
+}
+
+// Ends the stream of a request that joined another's run
+void joined_stream_end(void *ctx, int exit_status)
+{
+    reply_stream_end(ctx, exit_status);
+    free(ctx);
+}
+
+void snapshot_release(ClientSnapshot *snapshot)
+{
+    if (__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(snapshot);
+}
+
+// Formats the LIST reply from a copy of the registry taken under the lock, so
+// the formatting itself runs without holding it
+ClientSnapshot *snapshot_build(void)
+{
+    pthread_mutex_lock(&lock);
+    unsigned long version = registry_version;
+    int count = registry.count;
+    Client *copy = malloc((count > 0 ? count : 1) * sizeof(Client));
+    if (copy != NULL)
+        memcpy(copy, registry.clients, count * sizeof(Client));
+    pthread_mutex_unlock(&lock);
+    if (copy == NULL)
+        return NULL;
+
+    size_t capacity = 64 + (size_t)count * 48;
+    ClientSnapshot *snapshot = malloc(sizeof(ClientSnapshot) + capacity);
+    if (snapshot != NULL)
+    {
+        snapshot->refs = 1;
+        snapshot->version = version;
+        snapshot->length = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (!copy[i].hidden && copy[i].pid >= TCP_CLIENT_ID_BASE)
+                snapshot->length += snprintf(snapshot->text + snapshot->length, capacity - snapshot->length,
+                                             "Client %d --> (TCP connection %d)\n", i + 1, copy[i].pid - TCP_CLIENT_ID_BASE + 1);
+            else if (!copy[i].hidden)
+                snapshot->length += snprintf(snapshot->text + snapshot->length, capacity - snapshot->length,
+                                             "Client %d --> (PID %d)\n", i + 1, copy[i].pid);
+        }
+    }
+    free(copy);
+    return snapshot;
+}
+
+// Returns a reference to a snapshot no older than the registry at the time of
+// the call. Mutations only bump registry_version; the first LIST after one
+// rebuilds and publishes the snapshot, every other LIST just takes a reference.
+ClientSnapshot *snapshot_acquire(void)
+{
+    unsigned long version = __atomic_load_n(&registry_version, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&snapshot_lock);
+    ClientSnapshot *snapshot = published_snapshot;
+    if (snapshot != NULL)
+        __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&snapshot_lock);
+
+    if (snapshot != NULL && snapshot->version >= version)
+        return snapshot;
+
+    ClientSnapshot *fresh = snapshot_build();
+    if (fresh == NULL)
+        return snapshot; // Stale beats nothing
+    if (snapshot != NULL)
+        snapshot_release(snapshot);
+
+    pthread_mutex_lock(&snapshot_lock);
+    ClientSnapshot *old = NULL;
+    if (published_snapshot == NULL || published_snapshot->version < fresh->version)
+    {
+        old = published_snapshot;
+        __atomic_add_fetch(&fresh->refs, 1, __ATOMIC_RELAXED); // Reference held by published_snapshot
+        published_snapshot = fresh;
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    if (old != NULL)
+        snapshot_release(old);
+    return fresh;
+}
+
+void list_clients(const Message *request)
+{
+    ClientSnapshot *snapshot = snapshot_acquire();
+    if (snapshot == NULL)
+    {
+        send_response(request, "Error listing clients.");
+        return;
+    }
+
+    // No registry or snapshot lock is held while the reply goes out
+    send_reply_message(request->client_pid, request->request_id, 0, MSG_FLAG_END, 0, snapshot->text, snapshot->length);
+    snapshot_release(snapshot);
+}
+
+// Sets the hidden flag of a registered client; returns the previous value,
+// or -1 if the client is not registered
+int set_client_hidden(pid_t client_pid, int hidden)
+{
+    pthread_mutex_lock(&lock);
+    int previous = -1;
+    Client *client = registry_find(&registry, client_pid);
+    if (client != NULL)
+    {
+        previous = client->hidden;
+        if (previous != hidden)
+        {
+            client->hidden = hidden;
+            __atomic_add_fetch(&registry_version, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return previous;
+}
+
+void hide_client(const Message *request)
+{
+    if (set_client_hidden(request->client_pid, 1) == 1)
+        send_response(request, "You Are Already Hidden...");
+    else
+        send_response(request, "You Are Now Hidden...");
+}
+
+void unhide_client(const Message *request)
+{
+    if (set_client_hidden(request->client_pid, 0) == 0)
+        send_response(request, "You Are Not Hidden At All...");
+    else
+        send_response(request, "You Are Now Visible Again...");
+}
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define DEFAULT_REACTOR_THREADS 2
+#define EVENT_BATCH 64 // epoll events handled per wakeup
+#define URING_ENTRIES 256       // Submission slots of each reactor's ring
+#define URING_BUFFERS 64        // Registered output buffers per reactor; commands past that poll and read
+#define URING_BUFFER_SIZE 16384
+
+typedef enum
+{
+    IO_EPOLL, // epoll_wait, then read each ready pipe until EAGAIN
+    IO_URING  // Reads and polls queued on an io_uring, one io_uring_enter per batch
+} IoEngine;
+
+IoEngine io_engine = IO_EPOLL; // -I: how the reactors of the worker-pool core wait for commands
+
+// A running shell command. Spawned by whichever thread handled the request,
+// then owned by one reactor; it is done once its output has hit EOF and the
+// child has been reaped, in either order.
+typedef struct EventCommand
+{
+    struct EventCommand *prev;
+    struct EventCommand *next;
+    ReplyStream stream;
+    pid_t pid;
+    int out_fd; // Read end of the output pipe, -1 after EOF
+    int pidfd;  // -1 after the child was reaped, or without pidfd support
+    int exited;
+    int exit_status;
+    int timer_fd;  // Fires after command_timeout_ms; -1 once it fired, or without a timeout
+    int timed_out; // Killed by the timer, so the status says so instead of SIGKILL
+    int buffer;    // io_uring: registered buffer its output is read into, -1 to poll and read instead
+    int inflight;  // io_uring: operations the kernel still holds this command's sources for
+    int finished;  // Replied to and unlinked; freed once nothing is in flight
+    int paused;    // Output not read while a client it goes to is OUTBOX_HIGH_WATER frames behind
+    EventSource output_source;
+    EventSource exit_source;
+    EventSource timeout_source;
+} EventCommand;
+
+// Supervises running commands from one epoll instance or io_uring, so a
+// slow command costs two file descriptors instead of a blocked worker.
+// Other threads hand commands over through the handoff list and wake_fd;
+// everything else is only touched by the reactor's own thread.
+typedef struct
+{
+    int epoll_fd;
+    Uring *ring; // Set when the reactor runs on io_uring (-I uring) instead of epoll
+    int wake_fd; // eventfd
+    int signal_fd; // First reactor only: SIGCHLD, -1 elsewhere
+    pthread_mutex_t handoff_lock;
+    EventCommand *handoff; // Spawned but not watched yet, linked through next
+    EventCommand *running;
+    EventCommand *finished; // Freed after the batch, which may still mention them
+    int running_count;
+    int peak_running;
+    int paused_count; // Running commands whose output is paused
+    unsigned long supervised;
+    unsigned long io_syscalls; // epoll_wait, epoll_ctl and read; io_uring_enter is counted by the ring
+    char *buffers;             // URING_BUFFERS of URING_BUFFER_SIZE, registered with the ring
+    int free_buffers[URING_BUFFERS];
+    int free_buffer_count;
+    EventSource wake_source;
+    EventSource signal_source;
+} Reactor;
+
+Reactor *reactors = NULL;
+int reactor_count = DEFAULT_REACTOR_THREADS;
+unsigned int next_reactor = 0;
+int use_pidfd = 1; // Cleared on kernels without pidfd_open; SIGCHLD then drives reaping
+int paused_outputs = 0; // Paused commands on all reactors, so a drained outbox knows to wake them
+pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t drain_wake = PTHREAD_COND_INITIALIZER; // Shell-pool workers waiting for a slow client
+
+// Starts watching fd for source: an epoll registration, or a one-shot
+// operation on the ring (a fixed-buffer read for output that has a buffer,
+// a poll otherwise) that is armed again after each completion
+void reactor_arm(Reactor *reactor, int fd, EventSource *source)
+{
+    if (reactor->ring == NULL)
+    {
+        event_watch(reactor->epoll_fd, fd, EPOLLIN, source);
+        reactor->io_syscalls++;
+        return;
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe(reactor->ring);
+    if (sqe == NULL)
+    {
+        perror("io_uring_enter");
+        return;
+    }
+    int is_command = source->kind == EVENT_OUTPUT || source->kind == EVENT_EXIT || source->kind == EVENT_TIMEOUT;
+    EventCommand *cmd = is_command ? source->owner : NULL;
+    if (source->kind == EVENT_OUTPUT && cmd->buffer != -1)
+    {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long)(reactor->buffers + (size_t)cmd->buffer * URING_BUFFER_SIZE);
+        sqe->len = URING_BUFFER_SIZE;
+        sqe->buf_index = cmd->buffer;
+        sqe->off = -1; // A pipe has no offset
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLIN;
+    }
+    sqe->fd = fd;
+    sqe->user_data = (unsigned long)source;
+    source->armed = 1;
+    if (cmd != NULL)
+        cmd->inflight++;
+}
+
+// Stops watching fd. On the ring an operation still in flight is cancelled,
+// and its completion comes back later.
+void reactor_disarm(Reactor *reactor, int fd, EventSource *source)
+{
+    if (reactor->ring == NULL)
+    {
+        event_unwatch(reactor->epoll_fd, fd);
+        reactor->io_syscalls++;
+        return;
+    }
+    if (!source->armed)
+        return;
+    struct io_uring_sqe *sqe = uring_get_sqe(reactor->ring);
+    if (sqe == NULL)
+    {
+        perror("io_uring_enter");
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (unsigned long)source;
+    sqe->user_data = 0; // The cancellation's own completion is ignored
+}
+
+void reactor_finish(Reactor *reactor, EventCommand *cmd)
+{
+    if (cmd->out_fd != -1 || !cmd->exited)
+        return;
+
+    if (cmd->timer_fd != -1)
+    {
+        reactor_disarm(reactor, cmd->timer_fd, &cmd->timeout_source);
+        close(cmd->timer_fd);
+    }
+    reply_stream_end(&cmd->stream, cmd->timed_out ? STATUS_TIMED_OUT : cmd->exit_status);
+    if (cmd->prev != NULL)
+        cmd->prev->next = cmd->next;
+    else
+        reactor->running = cmd->next;
+    if (cmd->next != NULL)
+        cmd->next->prev = cmd->prev;
+    reactor->running_count--;
+    cmd->finished = 1;
+    cmd->next = reactor->finished;
+    reactor->finished = cmd;
+    command_gate_leave(&command_gate);
+}
+
+// Frees the finished commands nothing refers to any more; after each batch
+void reactor_collect(Reactor *reactor)
+{
+    EventCommand **link = &reactor->finished;
+    while (*link != NULL)
+    {
+        EventCommand *cmd = *link;
+        if (cmd->inflight > 0)
+        {
+            link = &cmd->next;
+            continue;
+        }
+        *link = cmd->next;
+        object_pool_put(&command_pool, cmd);
+    }
+}
+
+// Stops reading cmd's output while a client it goes to has OUTBOX_HIGH_WATER
+// frames waiting: the command blocks on its full pipe instead of the server
+// queueing its output without limit. Returns 1 if it paused.
+int reactor_pause(Reactor *reactor, EventCommand *cmd)
+{
+    if (cmd->timed_out)
+        return 0; // What is left is read in one go before the pipe is closed
+    // Counted before the check, so a drain the check misses still wakes us
+    __atomic_add_fetch(&paused_outputs, 1, __ATOMIC_SEQ_CST);
+    if (reply_stream_backlog(&cmd->stream) < OUTBOX_HIGH_WATER)
+    {
+        __atomic_sub_fetch(&paused_outputs, 1, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    if (reactor->ring == NULL)
+        reactor_disarm(reactor, cmd->out_fd, &cmd->output_source); // The ring's read is just not queued again
+    cmd->paused = 1;
+    reactor->paused_count++;
+    return 1;
+}
+
+void reactor_unpause(Reactor *reactor, EventCommand *cmd)
+{
+    cmd->paused = 0;
+    reactor->paused_count--;
+    __atomic_sub_fetch(&paused_outputs, 1, __ATOMIC_SEQ_CST);
+}
+
+// Reads on for the paused commands whose clients have caught up
+void reactor_resume(Reactor *reactor)
+{
+    for (EventCommand *cmd = reactor->running; cmd != NULL && reactor->paused_count > 0; cmd = cmd->next)
+    {
+        if (cmd->paused && reply_stream_backlog(&cmd->stream) < OUTBOX_HIGH_WATER)
+        {
+            reactor_unpause(reactor, cmd);
+            reactor_arm(reactor, cmd->out_fd, &cmd->output_source);
+        }
+    }
+}
+
+// Streams whatever output is buffered in the pipe; returns 1 once it hit
+// EOF, 0 when the pipe is empty or the output paused
+int reactor_drain(Reactor *reactor, EventCommand *cmd)
+{
+    char buffer[MAX_CMD_LEN];
+    while (1)
+    {
+        ssize_t bytes_read = read(cmd->out_fd, buffer, sizeof(buffer));
+        reactor->io_syscalls++;
+        if (bytes_read > 0)
+        {
+            reply_stream_write(&cmd->stream, buffer, bytes_read);
+            if (reactor_pause(reactor, cmd))
+                return 0;
+            continue;
+        }
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read == -1 && errno == EAGAIN)
+            return 0;
+        if (bytes_read == -1)
+            perror("read");
+        return 1; // EOF, or an error that ends the stream all the same
+    }
+}
+
+void reactor_close_output(Reactor *reactor, EventCommand *cmd)
+{
+    if (cmd->paused)
+        reactor_unpause(reactor, cmd); // Not watched, so nothing to disarm
+    else
+        reactor_disarm(reactor, cmd->out_fd, &cmd->output_source);
+    close(cmd->out_fd);
+    cmd->out_fd = -1;
+    if (cmd->buffer != -1)
+        reactor->free_buffers[reactor->free_buffer_count++] = cmd->buffer;
+    cmd->buffer = -1;
+    reactor_finish(reactor, cmd);
+}
+
+// Streams whatever output is buffered in the pipe, without waiting for more
+void reactor_output(Reactor *reactor, EventCommand *cmd)
+{
+    if (reactor_drain(reactor, cmd))
+        reactor_close_output(reactor, cmd);
+    else if (reactor->ring != NULL && !cmd->paused)
+        reactor_arm(reactor, cmd->out_fd, &cmd->output_source);
+}
+
+// A fixed-buffer read of the ring came back with res bytes (0 at EOF)
+void reactor_output_read(Reactor *reactor, EventCommand *cmd, int res)
+{
+    if (res > 0)
+        reply_stream_write(&cmd->stream, reactor->buffers + (size_t)cmd->buffer * URING_BUFFER_SIZE, res);
+    if (res > 0 && !cmd->timed_out)
+    {
+        if (!reactor_pause(reactor, cmd))
+            reactor_arm(reactor, cmd->out_fd, &cmd->output_source);
+        return;
+    }
+    if (res < 0 && res != -ECANCELED)
+    {
+        errno = -res;
+        perror("io_uring read");
+    }
+    reactor_close_output(reactor, cmd);
+}
+
+// The command ran out of time: its whole process group is killed, so children
+// it left holding the pipe go too, and the client gets the output so far
+void reactor_timeout(Reactor *reactor, EventCommand *cmd)
+{
+    reactor_disarm(reactor, cmd->timer_fd, &cmd->timeout_source);
+    close(cmd->timer_fd);
+    cmd->timer_fd = -1;
+
+    // The group outlives its leader while a background child still holds the pipe
+    cmd->timed_out = 1;
+    if (kill(-cmd->pid, SIGKILL) == -1 && errno != ESRCH)
+        perror("kill");
+    printf("[Reactor Thread * %lu]: Command (PID %d) of client %d ran past %d ms, killed its process group\n", pthread_self(),
+           cmd->pid, cmd->stream.client_pid, command_timeout_ms);
+    if (cmd->out_fd != -1 && cmd->output_source.armed)
+        reactor_disarm(reactor, cmd->out_fd, &cmd->output_source); // Closed when the read comes back
+    else if (cmd->out_fd != -1)
+    {
+        reactor_drain(reactor, cmd);
+        reactor_close_output(reactor, cmd); // Anything still on its way is dropped
+    }
+}
+
+// Collects the exit status if the child is gone
+void reactor_reap(Reactor *reactor, EventCommand *cmd)
+{
+    int status;
+    if (waitpid(cmd->pid, &status, WNOHANG) <= 0)
+        return;
+
+    if (WIFEXITED(status))
+        cmd->exit_status = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        cmd->exit_status = 128 + WTERMSIG(status);
+    cmd->exited = 1;
+    if (cmd->pidfd != -1)
+    {
+        reactor_disarm(reactor, cmd->pidfd, &cmd->exit_source);
+        close(cmd->pidfd);
+        cmd->pidfd = -1;
+    }
+    reactor_finish(reactor, cmd);
+}
+
+// Without pidfds one SIGCHLD may stand for several children, so every
+// running command is checked. With them each child is reaped through its
+// own pidfd event instead.
+void reactor_reap_all(Reactor *reactor)
+{
+    EventCommand *cmd = reactor->running;
+    while (cmd != NULL)
+    {
+        EventCommand *next = cmd->next;
+        if (!cmd->exited)
+            reactor_reap(reactor, cmd);
+        cmd = next;
+    }
+}
+
+// Takes ownership of a spawned command; reactor thread only
+void reactor_watch(Reactor *reactor, EventCommand *cmd)
+{
+    cmd->prev = NULL;
+    cmd->next = reactor->running;
+    if (reactor->running != NULL)
+        reactor->running->prev = cmd;
+    reactor->running = cmd;
+    reactor->supervised++;
+    if (++reactor->running_count > reactor->peak_running)
+        reactor->peak_running = reactor->running_count;
+
+    // With a registered buffer the ring reads the pipe itself, and a read of
+    // a non-blocking pipe would come back with EAGAIN instead of waiting
+    cmd->buffer = -1;
+    if (reactor->ring != NULL && cmd->out_fd != -1 && reactor->free_buffer_count > 0)
+    {
+        cmd->buffer = reactor->free_buffers[--reactor->free_buffer_count];
+        fcntl(cmd->out_fd, F_SETFL, 0);
+    }
+    if (cmd->out_fd != -1)
+        reactor_arm(reactor, cmd->out_fd, &cmd->output_source);
+    if (cmd->timer_fd != -1)
+        reactor_arm(reactor, cmd->timer_fd, &cmd->timeout_source);
+    if (cmd->pidfd != -1)
+        reactor_arm(reactor, cmd->pidfd, &cmd->exit_source);
+    else
+        reactor_reap(reactor, cmd); // It may have exited before SIGCHLD was being listened for
+}
+
+void reactor_wake(Reactor *reactor)
+{
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) == -1)
+        perror("write eventfd");
+}
+
+// Hands a command spawned on another thread to the reactor
+void reactor_handoff(Reactor *reactor, EventCommand *cmd)
+{
+    pthread_mutex_lock(&reactor->handoff_lock);
+    cmd->next = reactor->handoff;
+    reactor->handoff = cmd;
+    pthread_mutex_unlock(&reactor->handoff_lock);
+    reactor_wake(reactor);
+}
+
+void reactor_take_handoffs(Reactor *reactor)
+{
+    uint64_t count;
+    reactor->io_syscalls++;
+    if (read(reactor->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        perror("read eventfd");
+
+    pthread_mutex_lock(&reactor->handoff_lock);
+    EventCommand *cmd = reactor->handoff;
+    reactor->handoff = NULL;
+    pthread_mutex_unlock(&reactor->handoff_lock);
+
+    while (cmd != NULL)
+    {
+        EventCommand *next = cmd->next;
+        reactor_watch(reactor, cmd);
+        cmd = next;
+    }
+    if (!use_pidfd)
+        reactor_reap_all(reactor);
+    if (reactor->paused_count > 0)
+        reactor_resume(reactor); // Woken by reply_drained()
+}
+
+// SIGCHLD on the first reactor; without pidfds every reactor checks its children
+void reactor_signals(Reactor *reactor)
+{
+    struct signalfd_siginfo info;
+    do
+        reactor->io_syscalls++;
+    while (read(reactor->signal_fd, &info, sizeof(info)) == sizeof(info));
+    if (!use_pidfd)
+    {
+        for (int r = 0; r < reactor_count; r++)
+            reactor_wake(&reactors[r]);
+    }
+}
+
+// A client fell back under OUTBOX_LOW_WATER (the reply outbox's
+// OutboxDrainFn): paused commands may read on, shell-pool workers may go on
+void reply_drained(void)
+{
+    if (__atomic_load_n(&paused_outputs, __ATOMIC_SEQ_CST) > 0)
+    {
+        for (int r = 0; r < reactor_count; r++)
+            reactor_wake(&reactors[r]);
+    }
+    pthread_mutex_lock(&drain_lock);
+    pthread_cond_broadcast(&drain_wake);
+    pthread_mutex_unlock(&drain_lock);
+}
+
+// Handles the command events of one epoll batch entry
+void reactor_dispatch(Reactor *reactor, EventSource *source)
+{
+    switch (source->kind)
+    {
+    case EVENT_OUTPUT:
+        reactor_output(reactor, source->owner);
+        break;
+    case EVENT_EXIT:
+        reactor_reap(reactor, source->owner);
+        break;
+    case EVENT_HANDOFF:
+        reactor_take_handoffs(reactor);
+        break;
+    case EVENT_TIMEOUT:
+        reactor_timeout(reactor, source->owner);
+        break;
+    case EVENT_SIGNALS:
+        reactor_signals(reactor);
+        break;
+    default:
+        break;
+    }
+}
+
+// Handles one completion of the ring, the counterpart of an epoll event
+void reactor_complete(Reactor *reactor, const struct io_uring_cqe *cqe)
+{
+    EventSource *source = (EventSource *)(unsigned long)cqe->user_data;
+    if (source == NULL)
+        return; // A cancellation reporting back
+    source->armed = 0;
+
+    if (source->kind == EVENT_HANDOFF || source->kind == EVENT_SIGNALS)
+    {
+        reactor_dispatch(reactor, source);
+        reactor_arm(reactor, source->kind == EVENT_HANDOFF ? reactor->wake_fd : reactor->signal_fd, source);
+        return;
+    }
+
+    EventCommand *cmd = source->owner;
+    cmd->inflight--;
+    if (cmd->finished || (cqe->res == -ECANCELED && source->kind != EVENT_OUTPUT))
+        return;
+    if (source->kind == EVENT_OUTPUT && cmd->buffer != -1)
+        reactor_output_read(reactor, cmd, cqe->res);
+    else if (source->kind == EVENT_OUTPUT && cqe->res < 0)
+        reactor_close_output(reactor, cmd);
+    else
+        reactor_dispatch(reactor, source);
+    if (source->kind == EVENT_EXIT && !cmd->exited && cmd->pidfd != -1)
+        reactor_arm(reactor, cmd->pidfd, source);
+}
+
+// Puts the reactor on io_uring with registered output buffers; returns -1 if
+// the kernel won't, leaving it on epoll
+int reactor_init_uring(Reactor *reactor)
+{
+    Uring *ring = malloc(sizeof(Uring));
+    if (ring == NULL || uring_init(ring, URING_ENTRIES) == -1)
+    {
+        free(ring);
+        return -1;
+    }
+    reactor->ring = ring;
+
+    // Without buffers (RLIMIT_MEMLOCK on older kernels) output is polled and read instead
+    struct iovec iov[URING_BUFFERS];
+    if (posix_memalign((void **)&reactor->buffers, 4096, (size_t)URING_BUFFERS * URING_BUFFER_SIZE) != 0)
+        reactor->buffers = NULL;
+    for (int i = 0; i < URING_BUFFERS && reactor->buffers != NULL; i++)
+    {
+        iov[i].iov_base = reactor->buffers + (size_t)i * URING_BUFFER_SIZE;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (reactor->buffers != NULL && uring_register_buffers(ring, iov, URING_BUFFERS) == 0)
+    {
+        for (int i = 0; i < URING_BUFFERS; i++)
+            reactor->free_buffers[reactor->free_buffer_count++] = URING_BUFFERS - 1 - i;
+    }
+    else
+        perror("io_uring register buffers, polling output instead");
+    return 0;
+}
+
+int reactor_init(Reactor *reactor)
+{
+    memset(reactor, 0, sizeof(Reactor));
+    pthread_mutex_init(&reactor->handoff_lock, NULL);
+    reactor->signal_fd = -1;
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epoll_fd == -1 || reactor->wake_fd == -1)
+        return -1;
+    if (io_engine == IO_URING && !event_core && reactor_init_uring(reactor) == -1)
+    {
+        perror("io_uring, falling back to epoll");
+        io_engine = IO_EPOLL;
+    }
+    reactor->wake_source.kind = EVENT_HANDOFF;
+    reactor->wake_source.owner = reactor;
+    reactor_arm(reactor, reactor->wake_fd, &reactor->wake_source);
+    return 0;
+}
+
+// I/O system calls made for the reactor's commands so far
+unsigned long reactor_syscalls(Reactor *reactor)
+{
+    return reactor->io_syscalls + (reactor->ring != NULL ? reactor->ring->enters : 0);
+}
+
+// Reactor thread of the worker-pool core. The first one also owns SIGCHLD,
+// which is blocked in every thread, and passes it on to all the others.
+void *reactor_thread(void *arg)
+{
+    Reactor *reactor = arg;
+    if (reactor == &reactors[0])
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        reactor->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        reactor->signal_source.kind = EVENT_SIGNALS;
+        reactor->signal_source.owner = reactor;
+        if (reactor->signal_fd == -1)
+            perror("signalfd");
+        else
+            reactor_arm(reactor, reactor->signal_fd, &reactor->signal_source);
+    }
+
+    struct epoll_event events[EVENT_BATCH];
+    while (1)
+    {
+        // The first reactor also times out commands waiting for a slot
+        int timeout = reactor == &reactors[0] ? command_gate_expire(&command_gate) : -1;
+        if (reactor->ring != NULL)
+        {
+            if (uring_submit_and_wait(reactor->ring, timeout) == -1 && errno != ETIME && errno != EINTR)
+                perror("io_uring_enter");
+            struct io_uring_cqe *cqe;
+            while ((cqe = uring_peek_cqe(reactor->ring)) != NULL)
+            {
+                struct io_uring_cqe completion = *cqe;
+                uring_cqe_seen(reactor->ring);
+                reactor_complete(reactor, &completion);
+            }
+        }
+        else
+        {
+            int ready = epoll_wait(reactor->epoll_fd, events, EVENT_BATCH, timeout);
+            reactor->io_syscalls++;
+            for (int i = 0; i < ready; i++)
+                reactor_dispatch(reactor, events[i].data.ptr);
+        }
+        reactor_collect(reactor);
+    }
+    return NULL;
+}
+
+// Starts a shell command with its output going to a non-blocking pipe.
+// Returns it ready for reactor_watch(), or NULL after replying with the error.
+EventCommand *command_spawn(Message *msg)
+{
+    int pipefd[2];
+    // Close-on-exec so concurrently spawned commands don't inherit each other's pipes
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        send_response(msg, "Error creating pipe.");
+        return NULL;
+    }
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK); // The child keeps a blocking write end
+
+    EventCommand *cmd = object_pool_get(&command_pool);
+    if (cmd != NULL)
+        memset(cmd, 0, sizeof(EventCommand));
+    pid_t pid = cmd == NULL ? -1 : spawn_command(msg->command, pipefd[1], spawn_mode);
+    close(pipefd[1]);
+    if (pid == -1)
+    {
+        perror("spawn");
+        close(pipefd[0]);
+        if (cmd != NULL)
+            object_pool_put(&command_pool, cmd);
+        send_response(msg, "Error forking process.");
+        return NULL;
+    }
+
+    cmd->stream.client_pid = msg->client_pid;
+    cmd->stream.request_id = msg->request_id;
+    cmd->stream.capture = output_capture_begin(msg->command);
+    cmd->pid = pid;
+    cmd->out_fd = pipefd[0];
+    cmd->exit_status = -1;
+    cmd->output_source.kind = EVENT_OUTPUT;
+    cmd->output_source.owner = cmd;
+    cmd->exit_source.kind = EVENT_EXIT;
+    cmd->exit_source.owner = cmd;
+    cmd->timeout_source.kind = EVENT_TIMEOUT;
+    cmd->timeout_source.owner = cmd;
+    cmd->timer_fd = -1;
+    if (command_timeout_ms > 0)
+    {
+        struct itimerspec expiry = {{0, 0}, {command_timeout_ms / 1000, (command_timeout_ms % 1000) * 1000000L}};
+        cmd->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (cmd->timer_fd != -1 && timerfd_settime(cmd->timer_fd, 0, &expiry, NULL) == -1)
+        {
+            close(cmd->timer_fd);
+            cmd->timer_fd = -1;
+        }
+        if (cmd->timer_fd == -1)
+            perror("timerfd, running without a timeout");
+    }
+
+    cmd->pidfd = use_pidfd ? syscall(SYS_pidfd_open, pid, 0) : -1;
+    if (cmd->pidfd == -1 && use_pidfd)
+    {
+        perror("pidfd_open, reaping children on SIGCHLD instead");
+        use_pidfd = 0;
+    }
+    return cmd;
+}
+
+// Answers msg from the output cache; returns 0 on a miss
+int serve_cached_output(Message *msg)
+{
+    CachedOutput *output = output_cache_get(msg->command);
+    if (output == NULL)
+        return 0;
+
+    ReplyStream stream = {msg->client_pid, msg->request_id, 0, NULL, NULL, 0, 0};
+    reply_stream_write(&stream, output->data, output->length);
+    reply_stream_end(&stream, output->exit_status);
+    output_cache_put(output);
+    return 1;
+}
+
+// Attaches msg to an identical command that is already running and returns
+// 1, or returns 0 with *flight set for msg's own run to lead (NULL when
+// coalescing is off)
+int join_running_command(Message *msg, Flight **flight)
+{
+    *flight = NULL;
+    if (!coalesce_commands)
+        return 0;
+
+    ReplyStream *stream = calloc(1, sizeof(ReplyStream));
+    if (stream == NULL)
+        return 0;
+    stream->client_pid = msg->client_pid;
+    stream->request_id = msg->request_id;
+    if (single_flight_join(msg->command, stream, flight))
+        return 1;
+    free(stream);
+    return 0;
+}
+
+// A shell command waiting at the gate for a slot to run in
+typedef struct
+{
+    GateWaiter waiter; // First, so the gate's waiter is the PendingCommand
+    Message msg;
+    Flight *flight;
+} PendingCommand;
+
+// What command_admit() hands pending_make()
+typedef struct
+{
+    const Message *msg;
+    Flight *flight;
+} PendingRequest;
+
+// Hands the read end of cmd's output pipe to a Unix socket client that asked
+// for it, so the output goes from the command to the client without the
+// server reading or copying it. The reactor then only waits for the exit
+// status. Returns 0 once the pipe is the client's.
+int command_pass_output(EventCommand *cmd, const Message *msg)
+{
+    // Output someone else shares or has partly sent must keep coming through us
+    if (!(msg->flags & MSG_FLAG_FD) || cmd->stream.flight != NULL || cmd->stream.seq != 0)
+        return -1;
+
+    Message frame = {0};
+    frame.msg_type = msg->client_pid;
+    frame.client_pid = msg->client_pid;
+    frame.request_id = msg->request_id;
+    frame.flags = MSG_FLAG_FD;
+    fcntl(cmd->out_fd, F_SETFL, 0); // Shared with the client's copy, which reads it blocking
+    if (sock_send_reply(msg->client_pid, &frame, cmd->out_fd) != 0) // Full: the output comes through us after all
+    {
+        fcntl(cmd->out_fd, F_SETFL, O_NONBLOCK);
+        return -1;
+    }
+    close(cmd->out_fd);
+    cmd->out_fd = -1;
+    cmd->stream.seq = 1;
+    if (cmd->stream.capture != NULL)
+    {
+        output_capture_finish(cmd->stream.capture, -1); // Never saw the output, so nothing to cache
+        cmd->stream.capture = NULL;
+    }
+    __atomic_add_fetch(&fds_passed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// Spawns msg in the slot it holds and hands it to a reactor (the event loop
+// watches it itself), or gives the slot back if it cannot be started
+void command_run(Message *msg, Flight *flight, int seq)
+{
+    EventCommand *cmd = command_spawn(msg);
+    if (cmd == NULL)
+    {
+        if (flight != NULL)
+            single_flight_land(flight, -1);
+        command_gate_leave(&command_gate);
+        return;
+    }
+    cmd->stream.seq = seq; // Continue after anything a crashed shell worker sent
+    cmd->stream.flight = flight;
+    if (!event_core)
+        command_pass_output(cmd, msg);
+    if (event_core)
+        reactor_watch(&reactors[0], cmd);
+    else
+        reactor_handoff(&reactors[__atomic_fetch_add(&next_reactor, 1, __ATOMIC_RELAXED) % reactor_count], cmd);
+}
+
+void refuse_busy(const Message *msg, Flight *flight, const char *note)
+{
+    send_reply_message(msg->client_pid, msg->request_id, 0, MSG_FLAG_END | MSG_FLAG_INFO, STATUS_TRY_LATER, note, strlen(note));
+    if (flight != NULL)
+        single_flight_land(flight, STATUS_TRY_LATER);
+}
+
+// Copies a request that has to wait for a slot; NULL refuses it when the pool is empty
+GateWaiter *pending_make(void *ctx)
+{
+    const PendingRequest *request = ctx;
+    PendingCommand *pending = object_pool_get(&pending_pool);
+    if (pending == NULL)
+        return NULL;
+    pending->msg = *request->msg;
+    pending->flight = request->flight;
+    return &pending->waiter;
+}
+
+void pending_start(GateWaiter *waiter)
+{
+    PendingCommand *pending = (PendingCommand *)waiter;
+    command_run(&pending->msg, pending->flight, 0);
+    object_pool_put(&pending_pool, pending);
+}
+
+void pending_timeout(GateWaiter *waiter)
+{
+    PendingCommand *pending = (PendingCommand *)waiter;
+    refuse_busy(&pending->msg, pending->flight, "Server busy: no command slot freed up in time, try again later.");
+    object_pool_put(&pending_pool, pending);
+}
+
+// Takes a command slot for msg and returns 1, or returns 0 with msg left
+// waiting for one (started later by pending_start) or refused
+int command_admit(Message *msg, Flight *flight)
+{
+    PendingRequest request = {msg, flight};
+    GateResult result = command_gate_enter(&command_gate, pending_make, &request);
+    if (result == GATE_WAIT)
+    {
+        if (!event_core)
+            reactor_wake(&reactors[0]); // The first reactor keeps time for the wait queue
+        return 0;
+    }
+    if (result == GATE_BUSY)
+        refuse_busy(msg, flight, "Server busy, try again later.");
+    return result == GATE_RUN;
+}
+
+// Output of a command in a shell-pool worker. The worker thread runs the
+// command anyway, so it waits out a client that has fallen behind, where a
+// reactor would stop reading; no longer than the command may run.
+void shell_stream_write(void *ctx, const char *data, int length)
+{
+    ReplyStream *stream = ctx;
+    reply_stream_write(stream, data, length);
+
+    pthread_mutex_lock(&drain_lock);
+    while (reply_stream_backlog(stream) >= OUTBOX_HIGH_WATER)
+    {
+        struct timespec now, until;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (stream->deadline_ms != 0 && now.tv_sec * 1000L + now.tv_nsec / 1000000 >= stream->deadline_ms)
+            break; // shell_worker_run() kills it next
+        clock_gettime(CLOCK_REALTIME, &until); // The condition variable's clock
+        until.tv_sec += 1;                     // Checked again every second in any case
+        pthread_cond_timedwait(&drain_wake, &drain_lock, &until);
+    }
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void run_shell_command(Message *msg)
+{
+    ReplyStream stream = {msg->client_pid, msg->request_id, 0, NULL, NULL, 0, 0};
+    if (serve_cached_output(msg) || join_running_command(msg, &stream.flight) || !command_admit(msg, stream.flight))
+        return;
+    int exit_status = -1;
+
+    // Simple external commands are cheapest to exec directly. Anything that needs
+    // bash anyway (shell syntax, builtins) goes to an idle pre-forked shell, and
+    // is spawned when they are all busy.
+    // A client taking the output pipe needs a command of its own, not a shared shell
+    int direct = spawn_mode == SPAWN_DIRECT && is_simple_command(msg->command) && !is_shell_builtin(msg->command);
+    ShellWorker *worker = direct || (msg->flags & MSG_FLAG_FD) ? NULL : shell_pool_acquire();
+    if (worker != NULL)
+    {
+        stream.capture = output_capture_begin(msg->command);
+        if (command_timeout_ms > 0)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            stream.deadline_ms = now.tv_sec * 1000L + now.tv_nsec / 1000000 + command_timeout_ms;
+        }
+        int rc = shell_worker_run(worker, msg->command, command_timeout_ms, shell_stream_write, &stream, &exit_status);
+        if (rc == 1)
+        {
+            printf("[Child Thread * %lu]: Command '%s' of client %d ran past %d ms, killed its shell worker\n", pthread_self(),
+                   msg->command, msg->client_pid, command_timeout_ms);
+            exit_status = STATUS_TIMED_OUT;
+            rc = 0;
+        }
+        if (rc == 0)
+            reply_stream_end(&stream, exit_status);
+        shell_pool_release(worker);
+        if (rc == 0)
+        {
+            command_gate_leave(&command_gate);
+            return;
+        }
+        if (stream.capture != NULL)
+            output_capture_finish(stream.capture, -1); // Dropped; the spawned command captures its own
+    }
+
+    // Otherwise hand the running command to a reactor, which streams its
+    // output and sends the final status, and free this worker straight away
+    command_run(msg, stream.flight, stream.seq);
+}
+
+// Runs the server's own commands; returns 0 if msg is a shell command instead
+int handle_builtin(Message *msg)
+{
+    if (strcmp(msg->command, "REGISTER") == 0)
+    {
+        // The ack goes out after the broadcast queue and any shared-memory
+        // channel are set up, so the client can wait for it instead of sleeping
+        RegisterAck ack = {0, CAP_PIPELINE};
+        int status = register_client(msg->client_pid, &ack) == 0 ? 0 : 1;
+        if (status == 0 && (msg->flags & MSG_FLAG_SHM) && shm_client_attach(msg->client_pid) == 0)
+            ack.capabilities |= CAP_SHM_CHANNEL;
+        else if (status == 0 && !event_core)
+        {
+            // A repeat REGISTER sent over an attached channel
+            ShmClient *client = shm_client_get(msg->client_pid);
+            if (client != NULL)
+            {
+                ack.capabilities |= CAP_SHM_CHANNEL;
+                shm_client_put(client);
+            }
+        }
+        if (event_core)
+            ack.capabilities |= CAP_EVENT_CORE;
+        if (shell_pool_size > 0 && !event_core)
+            ack.capabilities |= CAP_SHELL_POOL;
+        SockClient *sock_client = event_core ? NULL : sock_client_get(msg->client_pid);
+        if (sock_client != NULL)
+        {
+            ack.capabilities |= CAP_FD_PASSING;
+            sock_client_put(sock_client);
+        }
+        send_register_ack(msg, status, &ack);
+    }
+    else if (strcmp(msg->command, "EXIT") == 0)
+    {
+        pthread_mutex_lock(&lock);
+        int removed = registry_remove(&registry, msg->client_pid) == 0;
+        if (removed)
+            __atomic_add_fetch(&registry_version, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&lock);
+
+        FlowStats stats;
+        if (removed && fair_queue_forget(&request_queue, msg->client_pid, &stats) == 0)
+            printf("\n[Child Thread * %lu]: Client (PID %d) had %lu requests run, %lu refused by its rate limit, %lu refused with its share of the queue full\n",
+                   pthread_self(), msg->client_pid, stats.queued, stats.rate_limited, stats.overflowed);
+        if (removed)
+        {
+            printf("\n[Child Thread * %lu]: Cleaning up client (PID %d) resources...\n", pthread_self(), msg->client_pid);
+            send_response(msg, "Client disconnected successfully.");
+            unregister_client_shutdown(msg->client_pid);
+        }
+        shm_client_detach(msg->client_pid);
+    }
+    else if (strcmp(msg->command, "LIST") == 0)
+        list_clients(msg);
+    else if (strcmp(msg->command, "HIDE") == 0)
+        hide_client(msg);
+    else if (strcmp(msg->command, "UNHIDE") == 0)
+        unhide_client(msg);
+    else if (strcmp(msg->command, "exit") == 0)
+        send_response(msg, "Ignored 'exit' command as it may Exit ther Shell Session...");
+    else
+        return 0;
+    return 1;
+}
+
+void *handle_client(void *arg)
+{
+    Message *msg = arg;
+    if (!handle_builtin(msg))
+        run_shell_command(msg); // Treat as a shell command
+    object_pool_put(&message_pool, msg);
+    return NULL;
+}
+
+void *worker_thread(void *arg)
+{
+    (void)arg;
+    while (1)
+        handle_client(fifo_requests ? mpmc_ring_pop(&request_ring) : fair_queue_pop(&request_queue));
+
+    return NULL;
+}
+
+void send_shutdown_signal(pid_t client_pid)
+{
+    char queue_name[64];
+    mqd_t mq;
+
+    snprintf(queue_name, sizeof(queue_name), "/client_broadcast_%d", client_pid);
+
+    // Open the queue for writing
+    mq = mq_open(queue_name, O_WRONLY);
+    if (mq == (mqd_t)-1)
+    {
+        perror("mq_open failed");
+        return;
+    }
+
+    // Send shutdown message
+    const char *shutdown_msg = "SHUTDOWN";
+    mq_send(mq, shutdown_msg, strlen(shutdown_msg), 0);
+
+    mq_close(mq);
+}
+#define SHUTDOWN_FLOW_REPORT 64 // Clients whose counters are listed at shutdown
+
+// Runs on the main thread once it has taken SIGINT or SIGTERM, never in a
+// signal handler, so it may take locks and print like any other code
+void shutdown_server(int signo)
+{
+    printf("----------------------------------------------------------------------------------------------------------\n");
+    printf("[Main Thread -- %lu]: Signal %d received...\n", pthread_self(), signo);
+    printf("[Main Thread -- %lu]: Grecefully exiting...\n", pthread_self());
+    printf("[Main Thread -- %lu]: Cleaning up server and client resources...\n", pthread_self());
+    printf("[Main Thread -- %lu]: Broadcasting 'SHUTDOWN' message to all the clients...\n", pthread_self());
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < registry.count; i++)
+    {
+        if (registry.clients[i].pid < TCP_CLIENT_ID_BASE)
+            send_shutdown_signal(registry.clients[i].pid);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (event_core)
+    {
+        mq_unlink(SERVER_MQ_NAME);
+        printf("[Main Thread -- %lu]: Event loop stats: %lu requests, %lu replies deferred on a full queue, %lu dropped\n",
+               pthread_self(), event_requests, mq_frames_deferred, mq_frames_dropped);
+    }
+    else
+    {
+        msgctl(server_msg_queue, IPC_RMID, NULL);
+        msgctl(response_msg_queue, IPC_RMID, NULL);
+        unsigned long deferred, dropped;
+        int waiting;
+        reply_outbox_stats(&deferred, &dropped, &waiting);
+        printf("[Main Thread -- %lu]: Reply outbox stats: %lu frames waited for room at their client, %lu dropped, %d clients still waiting\n", pthread_self(),
+               deferred, dropped, waiting);
+        if (tcp_address != NULL)
+            printf("[Main Thread -- %lu]: TCP stats: %lu connections, %d still open, %lu dropped on a failed send\n", pthread_self(),
+                   tcp_connections, tcp_client_count, __atomic_load_n(&tcp_dropped, __ATOMIC_RELAXED));
+        if (listen_socket)
+        {
+            unlink(SERVER_SOCKET_PATH);
+            printf("[Main Thread -- %lu]: Unix socket stats: %d clients connected, %lu output pipes passed to clients\n", pthread_self(),
+                   __atomic_load_n(&sock_client_count, __ATOMIC_RELAXED), __atomic_load_n(&fds_passed, __ATOMIC_RELAXED));
+        }
+        if (fifo_requests)
+            printf("[Main Thread -- %lu]: Request ring stats: depth %d of %d, workers slept on empty %lu times, intake slept on full %lu times\n",
+                   pthread_self(), mpmc_ring_depth(&request_ring), request_ring.mask + 1, request_ring.empty_sleeps, request_ring.full_sleeps);
+        pthread_mutex_lock(&request_queue.mutex);
+        if (!fifo_requests)
+            printf("[Main Thread -- %lu]: Request queue stats: depth %d, peak %d of %d, blocked on full %lu times\n", pthread_self(),
+                   request_queue.depth, request_queue.peak_depth, request_queue.capacity, request_queue.full_waits);
+        pthread_mutex_unlock(&request_queue.mutex);
+    }
+    if (command_gate.limit > 0)
+    {
+        pthread_mutex_lock(&command_gate.lock);
+        printf("[Main Thread -- %lu]: Command gate stats: peak %d running (cap %d), %lu waited for a slot (peak %d at once), %lu timed out, %lu refused\n", pthread_self(),
+               command_gate.peak_running, command_gate.limit, command_gate.waited, command_gate.peak_waiting, command_gate.timed_out, command_gate.refused);
+        pthread_mutex_unlock(&command_gate.lock);
+    }
+    pthread_mutex_lock(&request_queue.mutex);
+    printf("[Main Thread -- %lu]: Fair queue stats: %lu requests run, %lu refused by a rate limit, %lu refused with a client's share of the queue full\n",
+           pthread_self(), request_queue.totals.queued, request_queue.totals.rate_limited, request_queue.totals.overflowed);
+    pthread_mutex_unlock(&request_queue.mutex);
+    pid_t pids[SHUTDOWN_FLOW_REPORT];
+    FlowStats flow_stats[SHUTDOWN_FLOW_REPORT];
+    int flows = fair_queue_flows(&request_queue, pids, flow_stats, SHUTDOWN_FLOW_REPORT);
+    for (int i = 0; i < flows; i++)
+    {
+        if (flow_stats[i].rate_limited + flow_stats[i].overflowed == 0)
+            continue;
+        if (pids[i] == 0)
+            printf("[Main Thread -- %lu]:   Unregistered senders: %lu run, %lu rate limited, %lu over their queue share\n", pthread_self(),
+                   flow_stats[i].queued, flow_stats[i].rate_limited, flow_stats[i].overflowed);
+        else
+            printf("[Main Thread -- %lu]:   Client (PID %d): %lu run, %lu rate limited, %lu over its queue share\n", pthread_self(), pids[i],
+                   flow_stats[i].queued, flow_stats[i].rate_limited, flow_stats[i].overflowed);
+    }
+    for (int r = 0; r < reactor_count && reactors != NULL; r++)
+        printf("[Main Thread -- %lu]: Reactor %d stats: supervised %lu commands, %d still running, peak %d at once, %lu I/O syscalls (%.1f per command)\n",
+               pthread_self(), r, reactors[r].supervised, reactors[r].running_count, reactors[r].peak_running, reactor_syscalls(&reactors[r]),
+               reactors[r].supervised > 0 ? (double)reactor_syscalls(&reactors[r]) / reactors[r].supervised : 0.0);
+    ObjectPool *pools[] = {&message_pool, &command_pool, &pending_pool};
+    for (int i = 0; i < 3; i++)
+    {
+        PoolStats stats;
+        object_pool_stats(pools[i], &stats);
+        if (stats.gets > 0)
+            printf("[Main Thread -- %lu]: %s pool stats: %lu gets, %.1f%% from the thread's own cache, %lu batches refilled and %lu handed back, "
+                   "%lu objects of %zu bytes carved, %lu in use\n", pthread_self(), pools[i]->name, stats.gets, 100.0 * stats.cache_hits / stats.gets,
+                   stats.refills, stats.flushes, stats.objects, pools[i]->size, stats.gets - stats.puts);
+    }
+    if (shell_pool_size > 0)
+    {
+        unsigned long served, recycled, crashed;
+        shell_pool_stats(&served, &recycled, &crashed);
+        printf("[Main Thread -- %lu]: Shell pool stats: served %lu commands, recycled %lu workers, %lu crashed\n", pthread_self(), served, recycled, crashed);
+    }
+    if (output_cache_enabled())
+    {
+        unsigned long hits, misses, evictions;
+        size_t bytes;
+        int entries;
+        output_cache_stats(&hits, &misses, &evictions, &bytes, &entries);
+        printf("[Main Thread -- %lu]: Output cache stats: %lu hits, %lu misses, %lu evictions, %d entries holding %zu bytes\n", pthread_self(),
+               hits, misses, evictions, entries, bytes);
+    }
+    if (single_flight_enabled())
+    {
+        unsigned long led, joined;
+        single_flight_stats(&led, &joined);
+        printf("[Main Thread -- %lu]: Single-flight stats: %lu commands run, %lu identical requests joined them\n", pthread_self(), led, joined);
+    }
+    printf("[Main Thread -- %lu]: Shutting down...\n", pthread_self());
+    exit(0);
+}
+
+#define EVENT_REQUEST_BATCH 32 // Requests taken per wakeup, so output keeps flowing under load
+
+void event_handle_request(Message *msg)
+{
+    event_requests++;
+    printf("\n[Main Thread -- %lu]: Received command '%s' from client (PID: %d). Running %d commands.\n", pthread_self(), msg->command, msg->client_pid, reactors[0].running_count);
+    if (!request_exempt(msg) && fair_queue_admit(&request_queue, msg->client_pid) == FAIR_RATE_LIMITED)
+    {
+        refuse_request(msg, FAIR_RATE_LIMITED);
+        return;
+    }
+
+    // The reply queue has to be open before REGISTER is handled, EXIT's
+    // farewell has to go out before it is closed
+    if (strcmp(msg->command, "REGISTER") == 0)
+        mq_client_attach(msg->client_pid);
+    Flight *flight = NULL;
+    if (!handle_builtin(msg) && !serve_cached_output(msg) && !join_running_command(msg, &flight) && command_admit(msg, flight))
+        command_run(msg, flight, 0);
+    if (strcmp(msg->command, "EXIT") == 0)
+        mq_client_detach(msg->client_pid);
+}
+
+void event_handle_requests(void)
+{
+    for (int i = 0; i < EVENT_REQUEST_BATCH; i++)
+    {
+        Message msg;
+        if (mq_recv_frame(request_mq, &msg) == -1)
+        {
+            if (errno != EAGAIN)
+                perror("mq_receive");
+            if (errno != EBADMSG)
+                return;
+            continue;
+        }
+        event_handle_request(&msg);
+    }
+}
+
+// Returns 1 when the server should shut down
+int event_handle_signals(int signal_fd)
+{
+    struct signalfd_siginfo info;
+    int reap = 0;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo != SIGCHLD)
+            return 1;
+        reap = 1;
+    }
+
+    if (reap && !use_pidfd)
+        reactor_reap_all(&reactors[0]);
+    return 0;
+}
+
+// The -E core: a single thread takes requests from a non-blocking POSIX
+// queue, runs builtins inline and commands asynchronously, and never blocks
+// anywhere but in epoll_wait
+void run_event_loop(void)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = MQ_MAX_MESSAGES;
+    attr.mq_msgsize = MQ_FRAME_MAX;
+    mq_unlink(SERVER_MQ_NAME); // Don't inherit requests or attributes from an earlier run
+    request_mq = mq_open(SERVER_MQ_NAME, O_CREAT | O_RDONLY | O_NONBLOCK | O_CLOEXEC, 0666, &attr);
+
+    // The loop is its own single reactor: commands are watched on its epoll instance
+    reactor_count = 1;
+    reactors = calloc(1, sizeof(Reactor));
+    if (signal_fd == -1 || request_mq == (mqd_t)-1 || reactors == NULL || reactor_init(&reactors[0]) == -1)
+    {
+        perror("event loop setup");
+        exit(1);
+    }
+    event_fd = reactors[0].epoll_fd;
+
+    EventSource request_source = {EVENT_REQUESTS, NULL, 0};
+    EventSource signal_source = {EVENT_SIGNALS, NULL, 0};
+    event_watch(event_fd, request_mq, EPOLLIN, &request_source);
+    event_watch(event_fd, signal_fd, EPOLLIN, &signal_source);
+
+    printf("[Main Thread -- %lu]: Event loop started. Waiting for client messages on '" SERVER_MQ_NAME "'...\n", pthread_self());
+
+    struct epoll_event events[EVENT_BATCH];
+    while (1)
+    {
+        int ready = epoll_wait(event_fd, events, EVENT_BATCH, command_gate_expire(&command_gate));
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            EventSource *source = events[i].data.ptr;
+            switch (source->kind)
+            {
+            case EVENT_REQUESTS:
+                event_handle_requests();
+                break;
+            case EVENT_SIGNALS:
+                if (event_handle_signals(signal_fd))
+                    shutdown_server(SIGINT);
+                break;
+            case EVENT_OUTPUT:
+            case EVENT_EXIT:
+            case EVENT_HANDOFF:
+            case EVENT_TIMEOUT:
+                reactor_dispatch(&reactors[0], source);
+                break;
+            case EVENT_REPLY_QUEUE:
+                if (mq_client_flush(source->owner) <= OUTBOX_LOW_WATER && reactors[0].paused_count > 0)
+                    reactor_resume(&reactors[0]); // Its commands read on
+                break;
+            }
+        }
+        reactor_collect(&reactors[0]);
+    }
+}
+
+// Takes requests off the SysV queue, received straight into pooled
+// messages which the workers hand back
+void *intake_thread(void *arg)
+{
+    (void)arg;
+    Message *msg = NULL;
+    Message refused; // Takes the request off the queue when there is no pooled message for it
+    while (1)
+    {
+        if (msg == NULL)
+            msg = object_pool_get(&message_pool);
+        if (msg_recv_frame(server_msg_queue, msg != NULL ? msg : &refused, 0, 0) == -1)
+        {
+            if (errno == EIDRM)
+                break; // Removed by shutdown_server()
+            perror("msgrcv");
+            continue;
+        }
+        if (msg == NULL)
+        {
+            refuse_no_memory(&refused);
+            continue;
+        }
+
+        printf("\n[Intake Thread * %lu]: Received command '%s' from client (PID: %d). Handing it to the worker pool.\n", pthread_self(), msg->command, msg->client_pid);
+        queue_request(msg);
+        msg = NULL;
+    }
+    return NULL;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-w worker_threads] [-q queue_capacity] [-Q fair|ring] [-e fork|bash|direct] [-p shell_workers] [-r recycle_after] [-a reactor_threads] [-I epoll|uring] [-E]\n"
+                    "          [-c cacheable_prefix,... [-t cache_ttl_ms] [-m cache_kb]] [-s] [-l requests_per_sec[:burst]]\n"
+                    "          [-j max_running [-k wait_slots] [-W wait_ms]] [-T timeout_ms] [-u cpu_seconds] [-V memory_mb] [-U] [-N [host:]port]\n", prog);
+    fprintf(stderr, "  -e  how commands are started (default direct: simple commands exec'd without a shell, the rest through bash)\n");
+    fprintf(stderr, "  -p  keep this many bash shells to run the commands that need one; only with -e direct, as -e fork|bash start every command their own way\n");
+    fprintf(stderr, "  -Q  how requests reach the workers: per-client fair queue (default), or a lock-free first-come first-served ring\n");
+    fprintf(stderr, "  -I  how reactors wait for commands: epoll (default), or io_uring with registered buffers (falls back to epoll)\n");
+    fprintf(stderr, "  -E  single-threaded epoll core serving clients over POSIX queues (client -t mq)\n");
+    fprintf(stderr, "  -c  cache the output of simple commands starting with these words, e.g. -c 'uptime,df -h,ls /etc'\n");
+    fprintf(stderr, "  -s  requests for a command that is already running share its output instead of starting it again\n");
+    fprintf(stderr, "  -l  refuse requests of a client going faster than this (REGISTER and EXIT are never refused)\n");
+    fprintf(stderr, "  -j  run at most this many commands at once (0: no cap); others wait up to -W ms in a queue of -k, then get 'Server busy'\n");
+    fprintf(stderr, "  -T  kill a command's whole process group after this many ms and reply with its output so far (default %d, 0: never)\n", DEFAULT_COMMAND_TIMEOUT_MS);
+    fprintf(stderr, "  -U  also serve clients on the Unix socket '" SERVER_SOCKET_PATH "' (client -t unix), passing them command output as a pipe\n");
+    fprintf(stderr, "  -N  also serve network clients over TCP (client --connect host:port), on 127.0.0.1 unless a host is given, e.g. -N 5050\n");
+    fprintf(stderr, "      -N 0.0.0.0:5050 or -N [::]:5050 lets any host that reaches the port run commands as this user, with no authentication\n");
+    fprintf(stderr, "  -u  limit each command to this many seconds of CPU time;  -V  limit its address space to this many MB\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "w:q:Q:e:p:r:a:I:Ec:t:m:sl:j:k:W:T:u:V:UN:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            worker_count = atoi(optarg);
+            break;
+        case 'q':
+            queue_capacity = atoi(optarg);
+            break;
+        case 'Q':
+            if (strcmp(optarg, "fair") == 0)
+                fifo_requests = 0;
+            else if (strcmp(optarg, "ring") == 0)
+                fifo_requests = 1;
+            else
+                usage(argv[0]);
+            break;
+        case 'e':
+            if (parse_spawn_mode(optarg) == -1)
+                usage(argv[0]);
+            spawn_mode = parse_spawn_mode(optarg);
+            break;
+        case 'p':
+            shell_pool_size = atoi(optarg);
+            break;
+        case 'r':
+            shell_recycle = atoi(optarg);
+            break;
+        case 'a':
+            reactor_count = atoi(optarg);
+            break;
+        case 'E':
+            event_core = 1;
+            break;
+        case 'c':
+            cache_allow_list = optarg;
+            break;
+        case 't':
+            cache_ttl_ms = atoi(optarg);
+            break;
+        case 'm':
+            cache_kb = atoi(optarg);
+            break;
+        case 's':
+            coalesce_commands = 1;
+            break;
+        case 'l':
+            client_rate = atof(optarg);
+            client_burst = strchr(optarg, ':') != NULL ? atoi(strchr(optarg, ':') + 1) : (int)client_rate;
+            break;
+        case 'j':
+            max_running = atoi(optarg);
+            break;
+        case 'k':
+            wait_slots = atoi(optarg);
+            break;
+        case 'W':
+            wait_ms = atoi(optarg);
+            break;
+        case 'T':
+            command_timeout_ms = atoi(optarg);
+            break;
+        case 'u':
+            spawn_limits.cpu_seconds = atoi(optarg);
+            break;
+        case 'V':
+            spawn_limits.memory_mb = atoi(optarg);
+            break;
+        case 'U':
+            listen_socket = 1;
+            break;
+        case 'N':
+            tcp_address = optarg;
+            break;
+        case 'I':
+            if (strcmp(optarg, "epoll") == 0)
+                io_engine = IO_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                io_engine = IO_URING;
+            else
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (worker_count < 1 || queue_capacity < 1 || shell_pool_size < 0 || shell_recycle < 1 || reactor_count < 1 || cache_ttl_ms < 1 || cache_kb < 1 || client_rate < 0 || max_running < 0 || wait_slots < 0 || wait_ms < 1 || command_timeout_ms < 0 || spawn_limits.cpu_seconds < 0 || spawn_limits.memory_mb < 0)
+        usage(argv[0]);
+    if (shell_pool_size > 0 && spawn_mode != SPAWN_DIRECT)
+    {
+        fprintf(stderr, "%s: -p runs commands in pre-forked shells, which -e %s rules out; drop one of them\n", argv[0], spawn_mode_name(spawn_mode));
+        usage(argv[0]);
+    }
+
+    if (registry_init(&registry) == -1)
+    {
+        perror("registry_init");
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN); // A dead shell worker must not take the server down
+
+    printf("|################### I am the PARENT PROCESS (PID: %d) running this SERVER ##################|\n", getpid());
+    printf("|---------------------------------------------------------------------------------------------|\n");
+
+    printf("\n[Main Thread -- %lu]: I am the Server's Main Thread. My Parent Process is (PID: %d)...\n", pthread_self(), getppid());
+
+    if (cache_allow_list != NULL)
+    {
+        if (output_cache_init(cache_allow_list, cache_ttl_ms, (size_t)cache_kb * 1024) == -1)
+        {
+            perror("output_cache_init");
+            exit(1);
+        }
+        printf("[Main Thread -- %lu]: Caching the output of '%s' for %d ms, up to %d KB\n", pthread_self(), cache_allow_list, cache_ttl_ms, cache_kb);
+    }
+    object_pool_init(&message_pool, "Message", sizeof(Message));
+    object_pool_init(&command_pool, "Command", sizeof(EventCommand));
+    object_pool_init(&pending_pool, "Pending command", sizeof(PendingCommand));
+    pthread_attr_init(&small_stack);
+    pthread_attr_setstacksize(&small_stack, THREAD_STACK_SIZE);
+    fair_queue_init(&request_queue, queue_capacity, client_rate, client_burst);
+    fifo_requests = fifo_requests && !event_core; // The event-loop core has no workers to hand requests to
+    if (fifo_requests)
+    {
+        if (mpmc_ring_init(&request_ring, queue_capacity) == -1)
+        {
+            perror("request ring");
+            exit(1);
+        }
+        printf("[Main Thread -- %lu]: Requests reach the workers first come, first served through a lock-free ring of %d slots\n", pthread_self(),
+               request_ring.mask + 1);
+    }
+    command_gate_init(&command_gate, max_running, wait_slots, wait_ms, pending_start, pending_timeout);
+    if (max_running > 0)
+        printf("[Main Thread -- %lu]: Running at most %d commands at once; up to %d more wait for %d ms\n", pthread_self(), max_running, wait_slots, wait_ms);
+    if (command_timeout_ms > 0)
+        printf("[Main Thread -- %lu]: Commands are killed along with their process group after %d ms\n", pthread_self(), command_timeout_ms);
+    if (spawn_limits.cpu_seconds > 0 || spawn_limits.memory_mb > 0)
+        printf("[Main Thread -- %lu]: Commands are limited to %d s of CPU time and %d MB of address space (0: no limit)\n", pthread_self(),
+               spawn_limits.cpu_seconds, spawn_limits.memory_mb);
+    if (client_rate > 0)
+        printf("[Main Thread -- %lu]: Each client may send %.1f requests per second, %d at once\n", pthread_self(), client_rate, (int)request_queue.burst);
+    if (coalesce_commands)
+    {
+        single_flight_init(reply_stream_write, joined_stream_end, joined_stream_backlog);
+        printf("[Main Thread -- %lu]: Identical commands share one run while it is in flight\n", pthread_self());
+    }
+
+    // Blocked in every thread from here on: the event loop takes these from a
+    // signalfd, the worker-pool core's main thread with sigwait() and its
+    // first reactor SIGCHLD from a signalfd, so no handler ever interrupts
+    // a thread that holds a lock
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    if (event_core)
+    {
+        printf("[Main Thread -- %lu]: Running the event-loop core; shell commands are started with the '%s' spawn path\n", pthread_self(), spawn_mode_name(spawn_mode));
+        if (shell_pool_size > 0)
+            printf("[Main Thread -- %lu]: The shell pool is not used by the event-loop core\n", pthread_self());
+        if (listen_socket || tcp_address != NULL)
+            printf("[Main Thread -- %lu]: The Unix socket and TCP front-ends are not served by the event-loop core\n", pthread_self());
+        run_event_loop();
+    }
+    server_msg_queue = msgget(SERVER_QUEUE_KEY, IPC_CREAT | 0666);
+    response_msg_queue = msgget(RESPONSE_QUEUE_KEY, IPC_CREAT | 0666); // Create response queue
+    if (server_msg_queue == -1 || response_msg_queue == -1)
+    {
+        perror("msgget");
+        exit(1);
+    }
+
+    if (reply_outbox_init(send_reply_now, reply_drained) == -1)
+    {
+        perror("reply outbox");
+        exit(1);
+    }
+
+    reactors = calloc(reactor_count, sizeof(Reactor));
+    if (reactors == NULL)
+    {
+        perror("calloc reactors");
+        exit(1);
+    }
+    for (int i = 0; i < reactor_count; i++)
+    {
+        pthread_t thread;
+        if (reactor_init(&reactors[i]) == -1 || pthread_create(&thread, NULL, reactor_thread, &reactors[i]) != 0)
+        {
+            perror("reactor");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, &small_stack, worker_thread, NULL) != 0)
+        {
+            perror("pthread_create worker");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    printf("[Main Thread -- %lu]: Started %d worker threads fed by a request queue of %d slots, and %d reactor threads supervising running commands\n",
+           pthread_self(), worker_count, queue_capacity, reactor_count);
+    printf("[Main Thread -- %lu]: Shell commands are started with the '%s' spawn path\n", pthread_self(), spawn_mode_name(spawn_mode));
+    if (io_engine == IO_URING)
+        printf("[Main Thread -- %lu]: Reactors wait on io_uring, reading output into %d registered buffers of %d KB each\n", pthread_self(),
+               reactors[0].free_buffer_count, URING_BUFFER_SIZE / 1024);
+    if (shell_pool_size > 0)
+        printf("[Main Thread -- %lu]: Pre-forked %d of %d shell workers (recycled every %d commands)\n", pthread_self(),
+               shell_pool_init(shell_pool_size, shell_recycle), shell_pool_size, shell_recycle);
+
+    if (listen_socket)
+    {
+        static int socket_fd;
+        pthread_t thread;
+        socket_fd = socket_listen();
+        if (socket_fd == -1 || pthread_create(&thread, NULL, socket_thread, &socket_fd) != 0)
+        {
+            perror("socket thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+        printf("[Main Thread -- %lu]: Listening for clients on the Unix socket '" SERVER_SOCKET_PATH "'\n", pthread_self());
+    }
+    if (tcp_address != NULL)
+    {
+        static int tcp_fd;
+        pthread_t thread;
+        tcp_fd = tcp_listen(tcp_address);
+        tcp_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (tcp_fd == -1 || tcp_epoll_fd == -1 || pthread_create(&thread, NULL, tcp_thread, &tcp_fd) != 0)
+        {
+            perror("tcp thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+        printf("[Main Thread -- %lu]: Listening for network clients on TCP '%s'\n", pthread_self(), tcp_address);
+    }
+
+    pthread_t intake;
+    if (pthread_create(&intake, &small_stack, intake_thread, NULL) != 0)
+    {
+        perror("pthread_create intake");
+        exit(1);
+    }
+    pthread_detach(intake);
+    printf("[Main Thread -- %lu]: Broadcast message queue & Server message queue created. Waiting for the client messages...\n", pthread_self());
 
+    sigdelset(&signals, SIGCHLD); // The first reactor's
+    int signo;
+    while (sigwait(&signals, &signo) != 0)
+        ;
+    shutdown_server(signo);
     return 0;
 }
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/msg.h>
+
+#include "protocol.h"
+#include "shm_ring.h"
+#include "bench_client.h"
+
+static int server_msg_queue;
+static int response_msg_queue;
+static ShmChannel *channel;
+static int channel_attached; // Set once the REGISTER ack confirms the server attached the channel
+static mqd_t request_mq = (mqd_t)-1;
+static mqd_t reply_mq = (mqd_t)-1;
+
+double bench_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_mq(void)
+{
+    char name[64];
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = MQ_MAX_MESSAGES;
+    attr.mq_msgsize = MQ_FRAME_MAX;
+
+    snprintf(name, sizeof(name), CLIENT_REPLY_MQ_NAME, getpid());
+    mq_unlink(name);
+    request_mq = mq_open(SERVER_MQ_NAME, O_WRONLY);
+    if (request_mq == (mqd_t)-1)
+        return -1;
+    reply_mq = mq_open(name, O_CREAT | O_RDONLY, 0666, &attr);
+    return reply_mq == (mqd_t)-1 ? -1 : 0;
+}
+
+int bench_connect(const char *transport)
+{
+    Message stale;
+
+    channel = NULL;
+    channel_attached = 0;
+    request_mq = reply_mq = (mqd_t)-1;
+    if (strcmp(transport, "mq") == 0)
+        return connect_mq();
+    if (strcmp(transport, "sysv") != 0 && strcmp(transport, "shm") != 0)
+        return -1;
+
+    server_msg_queue = msgget(SERVER_QUEUE_KEY, 0666);
+    response_msg_queue = msgget(RESPONSE_QUEUE_KEY, 0666);
+    if (server_msg_queue == -1 || response_msg_queue == -1)
+        return -1;
+
+    // Drop replies left behind for an earlier process with our PID
+    while (msgrcv(response_msg_queue, &stale, sizeof(Message) - sizeof(long), getpid(), IPC_NOWAIT) != -1)
+        ;
+
+    if (strcmp(transport, "shm") == 0 && (channel = shm_channel_create(getpid())) == NULL)
+        return -1;
+    return 0;
+}
+
+void bench_send(const char *command)
+{
+    bench_send_tagged(command, 0);
+}
+
+void bench_send_tagged(const char *command, int request_id)
+{
+    Message msg;
+    msg.msg_type = 1;
+    msg.client_pid = getpid();
+    msg.request_id = request_id;
+    msg.seq = 0;
+    msg.flags = 0;
+    msg.status = 0;
+    msg.length = strlen(command);
+    memcpy(msg.command, command, msg.length);
+
+    if (request_mq != (mqd_t)-1)
+    {
+        if (mq_send_frame(request_mq, &msg) == -1)
+            perror("mq_send");
+        return;
+    }
+    if (channel != NULL && !channel_attached)
+        msg.flags |= MSG_FLAG_SHM;
+    else if (channel != NULL)
+    {
+        shm_ring_push(&channel->request, &msg, -1);
+        return;
+    }
+
+    if (msg_send_frame(server_msg_queue, &msg, 0) == -1)
+        perror("msgsnd");
+}
+
+int bench_wait_reply(void)
+{
+    return bench_wait_output(-1, NULL, 0, NULL);
+}
+
+int bench_wait_output(int request_id, char *data, int size, int *misrouted)
+{
+    Message msg;
+    int used = 0;
+    if (data != NULL && size > 0)
+        data[0] = '\0';
+    while (1)
+    {
+        int rc;
+        if (channel_attached)
+            rc = shm_ring_pop(&channel->response, &msg, -1);
+        else if (reply_mq != (mqd_t)-1)
+            rc = mq_recv_frame(reply_mq, &msg);
+        else
+            rc = msg_recv_frame(response_msg_queue, &msg, getpid(), 0);
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("receive reply");
+            return -1;
+        }
+        if (misrouted != NULL && (msg.client_pid != getpid() || (request_id != -1 && msg.request_id != request_id)))
+            (*misrouted)++;
+        if (data != NULL && !(msg.flags & MSG_FLAG_INFO) && msg.length > 0 && used < size - 1)
+        {
+            int copy = msg.length < size - 1 - used ? msg.length : size - 1 - used;
+            memcpy(data + used, msg.command, copy);
+            used += copy;
+            data[used] = '\0';
+        }
+        if (!(msg.flags & MSG_FLAG_END))
+            continue;
+
+        // Only REGISTER is sent before the channel is attached, and its ack
+        // comes back on the response queue saying whether it was
+        if (channel != NULL && !channel_attached)
+        {
+            RegisterAck ack = {0, 0};
+            if (msg.length == sizeof(ack))
+                memcpy(&ack, msg.command, sizeof(ack));
+            if (ack.capabilities & CAP_SHM_CHANNEL)
+                channel_attached = 1;
+            else
+                bench_disconnect();
+        }
+        return msg.status;
+    }
+}
+
+void bench_disconnect(void)
+{
+    if (reply_mq != (mqd_t)-1)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), CLIENT_REPLY_MQ_NAME, getpid());
+        mq_close(reply_mq);
+        mq_close(request_mq);
+        mq_unlink(name);
+        request_mq = reply_mq = (mqd_t)-1;
+    }
+    if (channel == NULL)
+        return;
+    shm_channel_close(channel);
+    shm_channel_unlink(getpid());
+    channel = NULL;
+    channel_attached = 0;
+}
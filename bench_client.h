@@ -0,0 +1,34 @@
+#ifndef BENCH_CLIENT_H
+#define BENCH_CLIENT_H
+
+// Client side of the server protocol for the benchmark tools. Each process
+// is one client; call bench_connect() after fork().
+
+// Connects over transport "sysv", "shm" (SysV plus our own shared-memory
+// channel) or "mq" (the POSIX queues of a server running with -E).
+// Returns 0, or -1 if the server is not running or transport is unknown.
+int bench_connect(const char *transport);
+
+// Sends one request. With shm, requests go through the server queue and
+// carry MSG_FLAG_SHM until the REGISTER ack confirms the channel.
+void bench_send(const char *command);
+
+// Same, tagged with request_id, which the server copies into every reply frame
+void bench_send_tagged(const char *command, int request_id);
+
+// Reads reply messages up to the end-of-stream marker and returns the exit
+// status it carries, or -1 on errors. A REGISTER ack refusing the shm
+// channel drops it, and the client carries on over SysV.
+int bench_wait_reply(void);
+
+// Like bench_wait_reply(), also collecting the reply's output into data
+// (NUL-terminated, cut to size) and counting into *misrouted every frame
+// addressed to another client, or to another request unless request_id is -1
+int bench_wait_output(int request_id, char *data, int size, int *misrouted);
+
+// Unmaps and removes the shared-memory channel or reply queue, if any
+void bench_disconnect(void);
+
+double bench_now_us(void);
+
+#endif
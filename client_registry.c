@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "client_registry.h"
+
+#define REGISTRY_INITIAL_SLOTS 64
+
+static unsigned int hash_pid(pid_t pid, int slot_count)
+{
+    // Fibonacci hashing spreads the mostly sequential PIDs across the table
+    return ((uint32_t)pid * 2654435761u) & (slot_count - 1);
+}
+
+// Slot holding pid, or the empty slot where it would go
+static int find_slot(const ClientRegistry *r, pid_t pid)
+{
+    unsigned int slot = hash_pid(pid, r->slot_count);
+    while (r->slots[slot] != -1 && r->clients[r->slots[slot]].pid != pid)
+        slot = (slot + 1) & (r->slot_count - 1);
+    return slot;
+}
+
+static int grow_slots(ClientRegistry *r)
+{
+    int new_count = r->slot_count * 2;
+    int *new_slots = malloc(new_count * sizeof(int));
+    if (new_slots == NULL)
+        return -1;
+
+    for (int i = 0; i < new_count; i++)
+        new_slots[i] = -1;
+    free(r->slots);
+    r->slots = new_slots;
+    r->slot_count = new_count;
+
+    for (int i = 0; i < r->count; i++)
+        r->slots[find_slot(r, r->clients[i].pid)] = i;
+    return 0;
+}
+
+int registry_init(ClientRegistry *r)
+{
+    r->count = 0;
+    r->capacity = REGISTRY_INITIAL_SLOTS / 2;
+    r->slot_count = REGISTRY_INITIAL_SLOTS;
+    r->clients = malloc(r->capacity * sizeof(Client));
+    r->slots = malloc(r->slot_count * sizeof(int));
+    if (r->clients == NULL || r->slots == NULL)
+        return -1;
+    for (int i = 0; i < r->slot_count; i++)
+        r->slots[i] = -1;
+    return 0;
+}
+
+Client *registry_find(ClientRegistry *r, pid_t pid)
+{
+    int index = r->slots[find_slot(r, pid)];
+    return index == -1 ? NULL : &r->clients[index];
+}
+
+Client *registry_add(ClientRegistry *r, pid_t pid)
+{
+    if (registry_find(r, pid) != NULL)
+        return NULL;
+
+    if (r->count == r->capacity)
+    {
+        Client *grown = realloc(r->clients, 2 * r->capacity * sizeof(Client));
+        if (grown == NULL)
+            return NULL;
+        r->clients = grown;
+        r->capacity *= 2;
+    }
+    // Keep the load factor at or below one half so probe runs stay short
+    if (2 * (r->count + 1) > r->slot_count && grow_slots(r) == -1)
+        return NULL;
+
+    Client *client = &r->clients[r->count];
+    client->pid = pid;
+    client->hidden = 0;
+    r->slots[find_slot(r, pid)] = r->count;
+    r->count++;
+    return client;
+}
+
+int registry_remove(ClientRegistry *r, pid_t pid)
+{
+    int mask = r->slot_count - 1;
+    int slot = find_slot(r, pid);
+    int index = r->slots[slot];
+    if (index == -1)
+        return -1;
+
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole so lookups never need tombstones
+    int hole = slot;
+    int next = (hole + 1) & mask;
+    while (r->slots[next] != -1)
+    {
+        int home = hash_pid(r->clients[r->slots[next]].pid, r->slot_count);
+        // Move the entry unless its home lies cyclically in (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            r->slots[hole] = r->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    r->slots[hole] = -1;
+
+    // Fill the gap in the dense array with the last client
+    int last = r->count - 1;
+    if (index != last)
+    {
+        r->clients[index] = r->clients[last];
+        r->slots[find_slot(r, r->clients[index].pid)] = index;
+    }
+    r->count--;
+    return 0;
+}
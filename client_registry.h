@@ -0,0 +1,37 @@
+#ifndef CLIENT_REGISTRY_H
+#define CLIENT_REGISTRY_H
+
+#include <sys/types.h>
+
+typedef struct
+{
+    pid_t pid;
+    int hidden;
+} Client;
+
+// Registered clients kept in a dense array (what LIST walks) plus an
+// open-addressing hash table of PID -> array index for O(1) lookups.
+// Not thread-safe; callers hold the server's registry lock.
+typedef struct
+{
+    Client *clients;
+    int count;
+    int capacity;
+    int *slots;     // Index into clients, or -1 for an empty slot
+    int slot_count; // Power of two, kept at least twice count
+} ClientRegistry;
+
+int registry_init(ClientRegistry *registry);
+
+// Returns the client with this PID, or NULL
+Client *registry_find(ClientRegistry *registry, pid_t pid);
+
+// Adds a visible client; returns NULL if the PID is already registered or
+// memory runs out. The pointer is only valid until the next add or remove.
+Client *registry_add(ClientRegistry *registry, pid_t pid);
+
+// Removes the client with this PID; returns 0 if it was registered, -1 if not.
+// The last client in the dense array moves into the freed position.
+int registry_remove(ClientRegistry *registry, pid_t pid);
+
+#endif
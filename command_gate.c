@@ -0,0 +1,135 @@
+#include <string.h>
+#include <time.h>
+
+#include "command_gate.h"
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+void command_gate_init(CommandGate *gate, int limit, int wait_limit, int wait_ms, GateFn on_start, GateFn on_timeout)
+{
+    memset(gate, 0, sizeof(CommandGate));
+    gate->limit = limit;
+    gate->wait_limit = wait_limit;
+    gate->wait_ms = wait_ms;
+    gate->on_start = on_start;
+    gate->on_timeout = on_timeout;
+    pthread_mutex_init(&gate->lock, NULL);
+}
+
+GateResult command_gate_enter(CommandGate *gate, GateWaitFn make_waiter, void *ctx)
+{
+    if (gate->limit == 0)
+        return GATE_RUN;
+
+    GateResult result = GATE_RUN;
+    pthread_mutex_lock(&gate->lock);
+    if (gate->running < gate->limit)
+    {
+        if (++gate->running > gate->peak_running)
+            gate->peak_running = gate->running;
+    }
+    else if (gate->waiting < gate->wait_limit)
+    {
+        GateWaiter *entry = make_waiter(ctx);
+        if (entry == NULL)
+        {
+            gate->refused++;
+            pthread_mutex_unlock(&gate->lock);
+            return GATE_BUSY;
+        }
+        entry->deadline_ms = now_ms() + gate->wait_ms;
+        entry->next = NULL;
+        if (gate->tail != NULL)
+            gate->tail->next = entry;
+        else
+            gate->head = entry;
+        gate->tail = entry;
+        gate->waited++;
+        if (++gate->waiting > gate->peak_waiting)
+            gate->peak_waiting = gate->waiting;
+        result = GATE_WAIT;
+    }
+    else
+    {
+        gate->refused++;
+        result = GATE_BUSY;
+    }
+    pthread_mutex_unlock(&gate->lock);
+    return result;
+}
+
+// Unlinks the waiters that are due by now into a list; caller holds the lock.
+// Deadlines are set in arrival order, so they are the ones at the head.
+static GateWaiter *take_overdue(CommandGate *gate, long now)
+{
+    GateWaiter *overdue = gate->head;
+    GateWaiter *last = NULL;
+    for (GateWaiter *entry = gate->head; entry != NULL && entry->deadline_ms <= now; entry = entry->next)
+    {
+        last = entry;
+        gate->waiting--;
+        gate->timed_out++;
+    }
+    if (last == NULL)
+        return NULL;
+    gate->head = last->next;
+    if (gate->head == NULL)
+        gate->tail = NULL;
+    last->next = NULL;
+    return overdue;
+}
+
+static void time_out_all(CommandGate *gate, GateWaiter *overdue)
+{
+    while (overdue != NULL)
+    {
+        GateWaiter *next = overdue->next;
+        gate->on_timeout(overdue);
+        overdue = next;
+    }
+}
+
+void command_gate_leave(CommandGate *gate)
+{
+    if (gate->limit == 0)
+        return;
+
+    pthread_mutex_lock(&gate->lock);
+    GateWaiter *overdue = take_overdue(gate, now_ms());
+    GateWaiter *next = gate->head;
+    if (next != NULL)
+    {
+        // The slot passes straight to the waiter, so running stays the same
+        gate->head = next->next;
+        if (gate->head == NULL)
+            gate->tail = NULL;
+        gate->waiting--;
+    }
+    else
+        gate->running--;
+    pthread_mutex_unlock(&gate->lock);
+
+    time_out_all(gate, overdue);
+    if (next != NULL)
+        gate->on_start(next);
+}
+
+int command_gate_expire(CommandGate *gate)
+{
+    if (gate->limit == 0)
+        return -1;
+
+    long now = now_ms();
+    pthread_mutex_lock(&gate->lock);
+    GateWaiter *overdue = take_overdue(gate, now);
+    int timeout = gate->head != NULL ? (int)(gate->head->deadline_ms - now) : -1;
+    pthread_mutex_unlock(&gate->lock);
+
+    time_out_all(gate, overdue);
+    return timeout;
+}
@@ -0,0 +1,69 @@
+#ifndef COMMAND_GATE_H
+#define COMMAND_GATE_H
+
+#include <pthread.h>
+
+#define DEFAULT_MAX_RUNNING 64
+#define DEFAULT_WAIT_SLOTS 256
+#define DEFAULT_WAIT_MS 2000
+
+typedef enum
+{
+    GATE_RUN,  // A slot was free and is now the caller's
+    GATE_WAIT, // The gate keeps the waiter until a slot frees up or it times out
+    GATE_BUSY  // Every slot and wait slot is taken
+} GateResult;
+
+// A command's place in the wait queue, kept inside the caller's own record
+// of the waiting command, so queueing one allocates nothing in the gate
+typedef struct GateWaiter
+{
+    struct GateWaiter *next;
+    long deadline_ms;
+} GateWaiter;
+
+// Called outside the gate's lock, from whichever thread freed the slot or
+// noticed the timeout
+typedef void (*GateFn)(GateWaiter *waiter);
+
+// Called under the gate's lock, only for a command that has to wait: returns
+// the filled-in record it waits in, or NULL to have it refused
+typedef GateWaiter *(*GateWaitFn)(void *ctx);
+
+// Caps how many commands run at once. Commands over the cap wait in FIFO
+// order for up to wait_ms; with the wait queue full too, they are refused.
+typedef struct
+{
+    int limit; // 0 for no cap
+    int running;
+    int peak_running;
+    int wait_limit;
+    int wait_ms;
+    GateWaiter *head;
+    GateWaiter *tail;
+    int waiting;
+    int peak_waiting;
+    unsigned long waited;    // Commands that had to wait for a slot
+    unsigned long timed_out; // Waited the full wait_ms without getting one
+    unsigned long refused;   // Found the wait queue full
+    GateFn on_start;         // Runs a waiter that has been given a slot
+    GateFn on_timeout;       // Refuses a waiter that has waited too long
+    pthread_mutex_t lock;
+} CommandGate;
+
+void command_gate_init(CommandGate *gate, int limit, int wait_limit, int wait_ms, GateFn on_start, GateFn on_timeout);
+
+// Takes a slot, or queues the record make_waiter(ctx) returns. The record is
+// made and filled in before it is queued, since a finishing command may
+// start it as soon as it is.
+GateResult command_gate_enter(CommandGate *gate, GateWaitFn make_waiter, void *ctx);
+
+// Gives up a slot: the oldest waiter still in time takes it over through
+// on_start, and any that ran out of time are passed to on_timeout
+void command_gate_leave(CommandGate *gate);
+
+// Times out overdue waiters; returns the ms until the next one is due, or
+// -1 with nobody waiting (an epoll_wait timeout)
+int command_gate_expire(CommandGate *gate);
+
+#endif
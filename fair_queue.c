@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fair_queue.h"
+
+#define FLOW_INITIAL_SLOTS 8
+
+typedef struct
+{
+    Message *msg;
+    int cost;
+} QueuedRequest;
+
+struct Flow
+{
+    pid_t pid;
+    Flow *hash_next;
+    Flow *active_next;
+    int active; // On the round-robin list
+    int retired; // Forgotten with requests still waiting; freed once they are served
+    QueuedRequest *slots; // Ring, grown on demand
+    int slot_count;
+    int head;
+    int depth;
+    int deficit;
+    double tokens;
+    double refilled_at; // Seconds, CLOCK_MONOTONIC
+    FlowStats stats;
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fair_queue_init(FairQueue *q, int capacity, double rate, int burst)
+{
+    memset(q, 0, sizeof(FairQueue));
+    q->capacity = capacity;
+    q->flow_limit = capacity / FAIR_FLOW_SHARE > 0 ? capacity / FAIR_FLOW_SHARE : 1;
+    q->rate = rate;
+    q->burst = burst > 0 ? burst : 1;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->strangers = calloc(1, sizeof(Flow));
+    if (q->strangers != NULL)
+    {
+        q->strangers->tokens = q->burst;
+        q->strangers->refilled_at = now_seconds();
+    }
+}
+
+// The flow of a tracked client, or NULL; caller holds the mutex
+static Flow *flow_find(FairQueue *q, pid_t pid)
+{
+    for (Flow *flow = q->flows[pid % FAIR_FLOW_BUCKETS]; flow != NULL; flow = flow->hash_next)
+    {
+        if (flow->pid == pid)
+            return flow;
+    }
+    return NULL;
+}
+
+// Requests of a client without a flow of its own share the strangers' one
+static Flow *flow_for(FairQueue *q, pid_t pid)
+{
+    Flow *flow = flow_find(q, pid);
+    return flow != NULL ? flow : q->strangers;
+}
+
+static void flow_free(FairQueue *q, Flow *flow)
+{
+    q->flow_count--;
+    free(flow->slots);
+    free(flow);
+}
+
+int fair_queue_track(FairQueue *q, pid_t pid)
+{
+    pthread_mutex_lock(&q->mutex);
+    if (flow_find(q, pid) != NULL)
+    {
+        pthread_mutex_unlock(&q->mutex);
+        return 0;
+    }
+
+    Flow **bucket = &q->flows[pid % FAIR_FLOW_BUCKETS];
+    Flow *flow = calloc(1, sizeof(Flow));
+    if (flow == NULL)
+    {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    flow->pid = pid;
+    flow->tokens = q->burst; // A new client starts with a full bucket
+    flow->refilled_at = now_seconds();
+    flow->hash_next = *bucket;
+    *bucket = flow;
+    q->flow_count++;
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+// Takes a token if the client has one; caller holds the mutex
+static int flow_take_token(FairQueue *q, Flow *flow)
+{
+    if (q->rate <= 0)
+        return 1;
+
+    double now = now_seconds();
+    flow->tokens += (now - flow->refilled_at) * q->rate;
+    if (flow->tokens > q->burst)
+        flow->tokens = q->burst;
+    flow->refilled_at = now;
+    if (flow->tokens < 1)
+        return 0;
+    flow->tokens -= 1;
+    return 1;
+}
+
+static int flow_append(Flow *flow, Message *msg, int cost)
+{
+    if (flow->depth == flow->slot_count)
+    {
+        int slot_count = flow->slot_count == 0 ? FLOW_INITIAL_SLOTS : 2 * flow->slot_count;
+        QueuedRequest *slots = malloc(slot_count * sizeof(QueuedRequest));
+        if (slots == NULL)
+            return -1;
+        for (int i = 0; i < flow->depth; i++)
+            slots[i] = flow->slots[(flow->head + i) % flow->slot_count];
+        free(flow->slots);
+        flow->slots = slots;
+        flow->slot_count = slot_count;
+        flow->head = 0;
+    }
+    QueuedRequest *slot = &flow->slots[(flow->head + flow->depth) % flow->slot_count];
+    slot->msg = msg;
+    slot->cost = cost;
+    flow->depth++;
+    return 0;
+}
+
+FairPushResult fair_queue_push(FairQueue *q, Message *msg, int cost, int limited)
+{
+    pthread_mutex_lock(&q->mutex);
+    Flow *flow = flow_for(q, msg->client_pid);
+    if (limited && flow != NULL && flow->depth >= q->flow_limit)
+    {
+        flow->stats.overflowed++;
+        q->totals.overflowed++;
+        pthread_mutex_unlock(&q->mutex);
+        return FAIR_OVERFLOWED;
+    }
+    if (limited && flow != NULL && !flow_take_token(q, flow))
+    {
+        flow->stats.rate_limited++;
+        q->totals.rate_limited++;
+        pthread_mutex_unlock(&q->mutex);
+        return FAIR_RATE_LIMITED;
+    }
+
+    if (q->depth == q->capacity)
+        q->full_waits++;
+    while (q->depth == q->capacity)
+        pthread_cond_wait(&q->not_full, &q->mutex);
+
+    // The client may have been forgotten while we waited
+    flow = flow_for(q, msg->client_pid);
+    if (flow == NULL || flow_append(flow, msg, cost) == -1)
+    {
+        pthread_cond_signal(&q->not_full); // The room we were woken for is still there
+        pthread_mutex_unlock(&q->mutex);
+        return FAIR_NO_MEMORY;
+    }
+    flow->stats.queued++;
+    q->totals.queued++;
+    if (!flow->active)
+    {
+        flow->active = 1;
+        flow->deficit = 0;
+        flow->active_next = NULL;
+        if (q->active_tail != NULL)
+            q->active_tail->active_next = flow;
+        else
+            q->active_head = flow;
+        q->active_tail = flow;
+    }
+    q->depth++;
+    if (q->depth > q->peak_depth)
+        q->peak_depth = q->depth;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return FAIR_QUEUED;
+}
+
+Message *fair_queue_pop(FairQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->depth == 0)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+
+    // The flow at the head is served while its deficit covers its next
+    // request, then goes to the back of the round with a fresh quantum
+    Flow *flow = q->active_head;
+    while (flow->deficit < flow->slots[flow->head].cost)
+    {
+        flow->deficit += FAIR_QUANTUM;
+        if (flow->active_next != NULL)
+        {
+            q->active_head = flow->active_next;
+            q->active_tail->active_next = flow;
+            q->active_tail = flow;
+            flow->active_next = NULL;
+        }
+        flow = q->active_head;
+    }
+
+    QueuedRequest *slot = &flow->slots[flow->head];
+    Message *msg = slot->msg;
+    flow->deficit -= slot->cost;
+    flow->head = (flow->head + 1) % flow->slot_count;
+    flow->depth--;
+    if (flow->depth == 0)
+    {
+        // Done for this round; an idle client does not bank deficit
+        flow->active = 0;
+        q->active_head = flow->active_next;
+        if (q->active_head == NULL)
+            q->active_tail = NULL;
+        if (flow->retired)
+            flow_free(q, flow);
+    }
+    q->depth--;
+
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return msg;
+}
+
+FairPushResult fair_queue_admit(FairQueue *q, pid_t pid)
+{
+    pthread_mutex_lock(&q->mutex);
+    Flow *flow = flow_for(q, pid);
+    FairPushResult result = FAIR_QUEUED;
+    if (flow != NULL && !flow_take_token(q, flow))
+    {
+        flow->stats.rate_limited++;
+        q->totals.rate_limited++;
+        result = FAIR_RATE_LIMITED;
+    }
+    else if (flow != NULL)
+    {
+        flow->stats.queued++;
+        q->totals.queued++;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return result;
+}
+
+int fair_queue_forget(FairQueue *q, pid_t pid, FlowStats *stats)
+{
+    pthread_mutex_lock(&q->mutex);
+    Flow **link = &q->flows[pid % FAIR_FLOW_BUCKETS];
+    while (*link != NULL && (*link)->pid != pid)
+        link = &(*link)->hash_next;
+
+    Flow *flow = *link;
+    if (flow == NULL)
+    {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    *stats = flow->stats;
+    *link = flow->hash_next;
+    if (flow->depth == 0)
+        flow_free(q, flow);
+    else
+        flow->retired = 1; // fair_queue_pop() frees it after its last request
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+int fair_queue_flows(FairQueue *q, pid_t *pids, FlowStats *stats, int max)
+{
+    int count = 0;
+    pthread_mutex_lock(&q->mutex);
+    if (q->strangers != NULL && max > 0)
+    {
+        pids[count] = 0;
+        stats[count] = q->strangers->stats;
+        count++;
+    }
+    for (int b = 0; b < FAIR_FLOW_BUCKETS && count < max; b++)
+    {
+        for (Flow *flow = q->flows[b]; flow != NULL && count < max; flow = flow->hash_next)
+        {
+            pids[count] = flow->pid;
+            stats[count] = flow->stats;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+}
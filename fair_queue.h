@@ -0,0 +1,86 @@
+#ifndef FAIR_QUEUE_H
+#define FAIR_QUEUE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "protocol.h"
+
+#define FAIR_FLOW_SHARE 4  // One client may hold at most 1/FAIR_FLOW_SHARE of the queue
+#define FAIR_QUANTUM 4     // Cost a client may be served per round
+#define FAIR_SHELL_COST 4  // Cost of a shell command; builtins cost 1
+#define FAIR_FLOW_BUCKETS 256
+
+typedef struct Flow Flow;
+
+// What happened to each client's requests
+typedef struct
+{
+    unsigned long queued;       // Accepted, then run in its turn
+    unsigned long rate_limited; // Refused: the client's token bucket was empty
+    unsigned long overflowed;   // Refused: the client already had its share of the queue waiting
+} FlowStats;
+
+typedef enum
+{
+    FAIR_QUEUED,
+    FAIR_RATE_LIMITED,
+    FAIR_OVERFLOWED,
+    FAIR_NO_MEMORY // The client's flow could not grow to hold the request
+} FairPushResult;
+
+// Bounded hand-off queue between the intake threads and the worker threads.
+// Requests wait in per-client flows, and workers take them by deficit round
+// robin across the clients that have any waiting, so a client flooding the
+// server only lengthens its own queue. Each client may also be held to a
+// token-bucket rate. Only registered clients get a flow of their own; all
+// other senders share one, share and bucket alike, so the table stays as
+// small as the client registry whoever sends requests.
+typedef struct
+{
+    int capacity;
+    int flow_limit;
+    double rate;  // Tokens per second, 0 for no rate limit
+    double burst; // Bucket size
+    Flow *flows[FAIR_FLOW_BUCKETS];
+    int flow_count;
+    Flow *strangers; // Requests of senders without a flow
+    Flow *active_head; // Round-robin order of the flows with requests waiting
+    Flow *active_tail;
+    int depth;                // Requests currently waiting for a worker
+    int peak_depth;           // High-water mark of depth
+    unsigned long full_waits; // Times an intake thread blocked on a full queue
+    FlowStats totals;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} FairQueue;
+
+// rate is in requests per second per client (0 turns the limit off), burst
+// how many it may send at once after being idle
+void fair_queue_init(FairQueue *q, int capacity, double rate, int burst);
+
+// Queues msg from msg->client_pid at the given cost. With limited set the
+// client's token bucket and share of the queue are checked first, and msg is
+// left to the caller unless FAIR_QUEUED is returned, which includes
+// FAIR_NO_MEMORY. Blocks while the whole queue is full, which pushes back
+// on the clients' msgsnd.
+FairPushResult fair_queue_push(FairQueue *q, Message *msg, int cost, int limited);
+
+Message *fair_queue_pop(FairQueue *q);
+
+// Gives the client a flow of its own; returns 0 (also if it had one) or -1
+int fair_queue_track(FairQueue *q, pid_t pid);
+
+// Token bucket alone, for the event-loop core which runs requests as they come
+FairPushResult fair_queue_admit(FairQueue *q, pid_t pid);
+
+// Drops the client's flow (freed once its waiting requests are served) and
+// returns 0 with its counters in stats, or -1 if the client has no flow
+int fair_queue_forget(FairQueue *q, pid_t pid, FlowStats *stats);
+
+// Copies out the counters of up to max clients, the shared flow first with
+// PID 0; returns how many
+int fair_queue_flows(FairQueue *q, pid_t *pids, FlowStats *stats, int max);
+
+#endif
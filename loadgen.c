@@ -0,0 +1,351 @@
+/******************************************************************************
+ * File: loadgen.c
+ *
+ * Load generator for the client/server pair. Forks N simulated clients that
+ * each REGISTER, then replay a weighted mix of REGISTER / LIST / HIDE /
+ * UNHIDE / shell commands against a running server for a fixed duration,
+ * optionally paced to a target aggregate request rate. Reports throughput
+ * and p50/p99/p999 round-trip latency per request type, plus a histogram.
+ *
+ * Latencies go into per-client log-linear histograms (16 sub-buckets per
+ * power of two, so every reported percentile is within ~6%) kept in shared
+ * memory and merged by the parent. When a rate is given, latency is measured
+ * from each request's scheduled send time, so a slow server cannot hide its
+ * queueing delay by holding clients back (coordinated omission).
+ *
+ * Usage: ./loadgen [-c clients] [-d seconds] [-r total_req_per_sec]
+ *                  [-m OP:weight,...] [-x shell_command] [-t sysv|shm|mq] [-s seed]
+ *        OPs: REGISTER LIST HIDE UNHIDE SHELL
+ *        Start the server first, with its output redirected to /dev/null.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "bench_client.h"
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_BUCKETS)
+
+typedef enum
+{
+    OP_REGISTER,
+    OP_LIST,
+    OP_HIDE,
+    OP_UNHIDE,
+    OP_SHELL,
+    OP_COUNT
+} Op;
+
+static const char *op_names[OP_COUNT] = {"REGISTER", "LIST", "HIDE", "UNHIDE", "SHELL"};
+
+typedef struct
+{
+    unsigned long counts[OP_COUNT][HIST_BUCKETS]; // Latency in nanoseconds, log-linear buckets
+    unsigned long failures[OP_COUNT];             // Replies with a non-zero status
+    unsigned long max_ns[OP_COUNT];
+} ClientStats;
+
+static int hist_bucket(unsigned long ns)
+{
+    if (ns < HIST_SUB_BUCKETS)
+        return ns;
+    int msb = 63 - __builtin_clzl(ns);
+    int sub = (ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+// Upper bound of a bucket in nanoseconds
+static double hist_upper(int bucket)
+{
+    if (bucket < HIST_SUB_BUCKETS)
+        return bucket + 1;
+    int msb = bucket / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    int sub = bucket % HIST_SUB_BUCKETS;
+    return (double)(HIST_SUB_BUCKETS + sub + 1) * (1UL << (msb - HIST_SUB_BITS));
+}
+
+static double hist_percentile(const unsigned long *counts, unsigned long total, double q)
+{
+    unsigned long target = (unsigned long)(q * total);
+    unsigned long seen = 0;
+    if (target >= total)
+        target = total - 1;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen += counts[b];
+        if (seen > target)
+            return hist_upper(b) / 1000.0;
+    }
+    return 0;
+}
+
+// Parses "LIST:60,SHELL:40" into weights; returns -1 on a bad entry
+static int parse_mix(const char *spec, int weights[OP_COUNT])
+{
+    char copy[256];
+    char *save;
+    snprintf(copy, sizeof(copy), "%s", spec);
+    memset(weights, 0, OP_COUNT * sizeof(int));
+
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strchr(item, ':');
+        if (colon == NULL)
+            return -1;
+        *colon = '\0';
+        int op;
+        for (op = 0; op < OP_COUNT && strcmp(item, op_names[op]) != 0; op++)
+            ;
+        if (op == OP_COUNT || atoi(colon + 1) < 0)
+            return -1;
+        weights[op] = atoi(colon + 1);
+    }
+    return 0;
+}
+
+static void sleep_until_us(double when)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)(when / 1e6);
+    ts.tv_nsec = (long)((when - ts.tv_sec * 1e6) * 1000);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        ;
+}
+
+static void run_client(int id, ClientStats *stats, const int weights[OP_COUNT], const char *shell_command,
+                       const char *transport, double start_at, double duration_us, double interval_us, unsigned int seed)
+{
+    int total_weight = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+        total_weight += weights[op];
+
+    if (bench_connect(transport) == -1)
+    {
+        perror("bench_connect");
+        _exit(1);
+    }
+    bench_send("REGISTER");
+    bench_wait_reply();
+    srand(seed + id);
+
+    // Stagger paced clients across one interval so they don't send in lockstep
+    double scheduled = start_at + (interval_us > 0 ? interval_us * id / 64.0 : 0);
+    sleep_until_us(start_at);
+
+    while (1)
+    {
+        if (interval_us > 0)
+        {
+            if (scheduled >= start_at + duration_us)
+                break;
+            sleep_until_us(scheduled);
+        }
+        else if (bench_now_us() >= start_at + duration_us)
+            break;
+
+        int pick = rand() % total_weight;
+        int op = 0;
+        while (pick >= weights[op])
+            pick -= weights[op++];
+
+        double sent = bench_now_us();
+        bench_send(op == OP_SHELL ? shell_command : op_names[op]);
+        int status = bench_wait_reply();
+        double from = interval_us > 0 ? scheduled : sent;
+        unsigned long ns = (unsigned long)((bench_now_us() - from) * 1000);
+
+        stats->counts[op][hist_bucket(ns)]++;
+        if (ns > stats->max_ns[op])
+            stats->max_ns[op] = ns;
+        if (status != 0)
+            stats->failures[op]++;
+        scheduled += interval_us;
+    }
+
+    bench_send("EXIT");
+    bench_wait_reply();
+    bench_disconnect();
+}
+
+static void print_row(const char *name, const unsigned long *counts, unsigned long failures, unsigned long max_ns, double seconds)
+{
+    unsigned long total = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+        total += counts[b];
+    if (total == 0)
+        return;
+    // A bucket's upper bound can overshoot the largest sample actually seen
+    double max_us = max_ns / 1000.0;
+    double p50 = hist_percentile(counts, total, 0.50);
+    double p99 = hist_percentile(counts, total, 0.99);
+    double p999 = hist_percentile(counts, total, 0.999);
+    printf("%-9s %10lu %10.0f %10.1f %10.1f %10.1f %10.1f %8lu\n", name, total, total / seconds,
+           p50 < max_us ? p50 : max_us, p99 < max_us ? p99 : max_us, p999 < max_us ? p999 : max_us, max_us, failures);
+}
+
+static void print_histogram(const unsigned long *counts)
+{
+    unsigned long per_octave[64] = {0};
+    unsigned long peak = 0;
+    int first = -1, last = -1;
+
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        int octave = b < HIST_SUB_BUCKETS ? 0 : b / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+        per_octave[octave] += counts[b];
+    }
+    for (int o = 0; o < 64; o++)
+    {
+        if (per_octave[o] == 0)
+            continue;
+        if (first == -1)
+            first = o;
+        last = o;
+        if (per_octave[o] > peak)
+            peak = per_octave[o];
+    }
+
+    printf("\nround-trip latency histogram (all requests):\n");
+    for (int o = first; o != -1 && o <= last; o++)
+    {
+        int bar = (int)(50.0 * per_octave[o] / peak);
+        printf("  %10.1f - %10.1f us |%-50.*s| %lu\n", (1UL << o) / 1000.0, (2UL << o) / 1000.0, bar,
+               "##################################################", per_octave[o]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int clients = 4;
+    double seconds = 10;
+    double rate = 0;
+    const char *mix = "REGISTER:5,LIST:50,HIDE:10,UNHIDE:10,SHELL:25";
+    const char *shell_command = "echo bench";
+    const char *transport = "sysv";
+    unsigned int seed = 1;
+    int weights[OP_COUNT];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:d:r:m:x:t:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'm':
+            mix = optarg;
+            break;
+        case 'x':
+            shell_command = optarg;
+            break;
+        case 't':
+            transport = optarg;
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-r total_req_per_sec] [-m OP:weight,...] [-x shell_command] [-t sysv|shm|mq] [-s seed]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int total_weight = 0;
+    if (parse_mix(mix, weights) == 0)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+            total_weight += weights[op];
+    }
+    if (clients < 1 || seconds <= 0 || rate < 0 || total_weight == 0)
+    {
+        fprintf(stderr, "%s: bad arguments (mix '%s')\n", argv[0], mix);
+        return 1;
+    }
+    if (bench_connect(transport) == -1)
+    {
+        perror("connect (is the server running? -t mq needs server -E)");
+        return 1;
+    }
+    bench_disconnect();
+
+    ClientStats *stats = mmap(NULL, clients * sizeof(ClientStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    double interval_us = rate > 0 ? 1e6 * clients / rate : 0;
+    double start_at = bench_now_us() + 200000 + clients * 1000.0; // Time for every client to fork and REGISTER
+    for (int c = 0; c < clients; c++)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0)
+        {
+            run_client(c, &stats[c], weights, shell_command, transport, start_at, seconds * 1e6, interval_us, seed);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    // Merge the per-client histograms
+    static unsigned long merged[OP_COUNT][HIST_BUCKETS];
+    static unsigned long all[HIST_BUCKETS];
+    unsigned long failures[OP_COUNT] = {0}, max_ns[OP_COUNT] = {0};
+    unsigned long all_failures = 0, all_max = 0;
+    for (int c = 0; c < clients; c++)
+    {
+        for (int op = 0; op < OP_COUNT; op++)
+        {
+            for (int b = 0; b < HIST_BUCKETS; b++)
+            {
+                merged[op][b] += stats[c].counts[op][b];
+                all[b] += stats[c].counts[op][b];
+            }
+            failures[op] += stats[c].failures[op];
+            if (stats[c].max_ns[op] > max_ns[op])
+                max_ns[op] = stats[c].max_ns[op];
+        }
+    }
+    for (int op = 0; op < OP_COUNT; op++)
+    {
+        all_failures += failures[op];
+        if (max_ns[op] > all_max)
+            all_max = max_ns[op];
+    }
+
+    printf("loadgen: %d clients over %s for %.1f s, mix %s, shell command '%s'\n", clients,
+           transport, seconds, mix, shell_command);
+    if (rate > 0)
+        printf("target rate: %.0f req/s (latency measured from scheduled send time)\n", rate);
+    else
+        printf("target rate: unlimited (each client sends its next request as soon as a reply completes)\n");
+    printf("%-9s %10s %10s %10s %10s %10s %10s %8s\n", "op", "count", "req/s", "p50_us", "p99_us", "p999_us", "max_us", "nonzero");
+    for (int op = 0; op < OP_COUNT; op++)
+        print_row(op_names[op], merged[op], failures[op], max_ns[op], seconds);
+    print_row("ALL", all, all_failures, all_max, seconds);
+    print_histogram(all);
+
+    munmap(stats, clients * sizeof(ClientStats));
+    return 0;
+}
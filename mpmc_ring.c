@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "mpmc_ring.h"
+
+#define MPMC_SPIN_COUNT 64 // Polls before falling back to a futex sleep
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static void futex_wait(uint32_t *word, uint32_t expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake_all(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 0x7fffffff, NULL, NULL, 0);
+}
+
+int mpmc_ring_init(MpmcRing *ring, int capacity)
+{
+    uint32_t size = 2;
+    while ((int)size < capacity && size < (1u << 30))
+        size <<= 1;
+
+    void *slots;
+    if (posix_memalign(&slots, MPMC_CACHE_LINE, size * sizeof(MpmcSlot)) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    *ring = (MpmcRing){0};
+    ring->mask = size - 1;
+    ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MPMC_SPIN_COUNT : 0;
+    ring->slots = slots;
+    for (uint32_t i = 0; i < size; i++)
+        ring->slots[i].sequence = i;
+    return 0;
+}
+
+void mpmc_ring_destroy(MpmcRing *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+// Waits until the slot's sequence reaches turn. A thread of the next lap
+// may be asleep on the same slot, so whoever moves it on wakes them all.
+static void slot_wait(MpmcSlot *slot, uint32_t turn, int spin_count, unsigned long *sleeps)
+{
+    for (int spin = 0; __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != turn; spin++)
+    {
+        if (spin == spin_count)
+            break;
+        cpu_relax();
+    }
+
+    // Saying we wait before the last look pairs with slot_publish() storing
+    // before it checks for waiters, so one of the two sees the other
+    while (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != turn)
+    {
+        __atomic_add_fetch(&slot->waiters, 1, __ATOMIC_SEQ_CST);
+        uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST);
+        if (sequence != turn)
+        {
+            __atomic_add_fetch(sleeps, 1, __ATOMIC_RELAXED);
+            futex_wait(&slot->sequence, sequence);
+        }
+        __atomic_sub_fetch(&slot->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void slot_publish(MpmcSlot *slot, uint32_t sequence)
+{
+    __atomic_store_n(&slot->sequence, sequence, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake_all(&slot->sequence);
+}
+
+// Claims the position at *counter if its slot is already at the turn for it
+// (offset from the position: 0 to fill it, 1 to empty it), like Vyukov's
+// original. Returns 0 and the position, or -1 once the ring is full/empty
+// and the caller has to take a position whatever its state and wait there.
+static int slot_claim(MpmcRing *ring, uint32_t *counter, uint32_t offset, uint32_t *claimed)
+{
+    uint32_t pos = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (1)
+    {
+        MpmcSlot *slot = &ring->slots[pos & ring->mask];
+        int32_t lag = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + offset));
+        if (lag == 0 && __atomic_compare_exchange_n(counter, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            *claimed = pos;
+            return 0;
+        }
+        if (lag < 0)
+            return -1;
+        if (lag > 0)
+            pos = __atomic_load_n(counter, __ATOMIC_RELAXED); // Somebody else claimed it
+    }
+}
+
+void mpmc_ring_push(MpmcRing *ring, void *item)
+{
+    uint32_t pos;
+    if (slot_claim(ring, &ring->enqueue_pos, 0, &pos) == -1)
+        pos = __atomic_fetch_add(&ring->enqueue_pos, 1, __ATOMIC_RELAXED);
+    MpmcSlot *slot = &ring->slots[pos & ring->mask];
+    slot_wait(slot, pos, ring->spin, &ring->full_sleeps); // Until the item from one lap ago is taken
+    slot->item = item;
+    slot_publish(slot, pos + 1);
+}
+
+void *mpmc_ring_pop(MpmcRing *ring)
+{
+    uint32_t pos;
+    if (slot_claim(ring, &ring->dequeue_pos, 1, &pos) == -1)
+        pos = __atomic_fetch_add(&ring->dequeue_pos, 1, __ATOMIC_RELAXED);
+    MpmcSlot *slot = &ring->slots[pos & ring->mask];
+    slot_wait(slot, pos + 1, ring->spin, &ring->empty_sleeps);
+    void *item = slot->item;
+    slot_publish(slot, pos + ring->mask + 1); // Free for the producer of the next lap
+    return item;
+}
+
+int mpmc_ring_depth(MpmcRing *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    int32_t depth = (int32_t)(tail - head);
+    return depth < 0 ? 0 : depth;
+}
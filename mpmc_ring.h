@@ -0,0 +1,50 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <stdint.h>
+
+#define MPMC_CACHE_LINE 64
+
+// One slot per cache line, so neighbouring producers and consumers don't
+// bounce each other's lines. sequence says whose turn the slot is: equal to
+// a position when the producer holding it may fill the slot, position + 1
+// once it holds an item for the consumer holding that position. It is also
+// the futex word threads sleep on while waiting for their turn.
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t waiters; // Threads asleep on sequence, or about to be
+    void *item;
+} __attribute__((aligned(MPMC_CACHE_LINE))) MpmcSlot;
+
+// Bounded multi-producer multi-consumer queue of pointers (Vyukov's ring,
+// with the per-slot futex sleep of folly's MPMCQueue). A producer or
+// consumer takes the next position with one atomic add, never a lock, and
+// waits only for its own slot; a wake-up is only issued when somebody is
+// asleep on that slot. Positions only ever grow (modulo 2^32).
+typedef struct
+{
+    uint32_t enqueue_pos;
+    char pad1[MPMC_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t dequeue_pos;
+    char pad2[MPMC_CACHE_LINE - sizeof(uint32_t)];
+    unsigned long empty_sleeps; // Times a consumer slept on an empty ring
+    unsigned long full_sleeps;  // Times a producer slept on a full ring
+    uint32_t mask;
+    int spin; // Polls before sleeping; none on a single CPU, where the other side can't run meanwhile
+    MpmcSlot *slots;
+} MpmcRing;
+
+// capacity is rounded up to a power of two; returns 0, or -1 with errno set
+int mpmc_ring_init(MpmcRing *ring, int capacity);
+void mpmc_ring_destroy(MpmcRing *ring);
+
+// Spin briefly, then sleep until there is room / an item. Items are handed
+// out in the order their producers took positions.
+void mpmc_ring_push(MpmcRing *ring, void *item);
+void *mpmc_ring_pop(MpmcRing *ring);
+
+// Items waiting; only a snapshot while other threads are at it
+int mpmc_ring_depth(MpmcRing *ring);
+
+#endif
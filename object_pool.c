@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "object_pool.h"
+
+struct PoolCache
+{
+    ObjectPool *pool;
+    PoolCache *next; // In pool->caches
+    void *free_list;
+    int count;
+    PoolStats stats; // Only the owning thread writes these
+};
+
+static __thread PoolCache *thread_caches[POOL_MAX];
+static int pool_count = 0;
+
+// Moves up to count objects from *from to *to, both linked through their first word
+static int move_objects(void **from, void **to, int count)
+{
+    int moved = 0;
+    while (moved < count && *from != NULL)
+    {
+        void *object = *from;
+        *from = *(void **)object;
+        *(void **)object = *to;
+        *to = object;
+        moved++;
+    }
+    return moved;
+}
+
+static void add_stats(PoolStats *total, const PoolStats *stats)
+{
+    total->gets += stats->gets;
+    total->puts += stats->puts;
+    total->cache_hits += stats->cache_hits;
+    total->refills += stats->refills;
+    total->flushes += stats->flushes;
+}
+
+// pthread key destructor: the thread is exiting with objects in its cache
+static void cache_release(void *arg)
+{
+    PoolCache *cache = arg;
+    ObjectPool *pool = cache->pool;
+    pthread_mutex_lock(&pool->lock);
+    pool->depot_count += move_objects(&cache->free_list, &pool->depot, cache->count);
+    add_stats(&pool->retired, &cache->stats);
+    PoolCache **link = &pool->caches;
+    while (*link != cache)
+        link = &(*link)->next;
+    *link = cache->next;
+    pthread_mutex_unlock(&pool->lock);
+    thread_caches[pool->id] = NULL;
+    free(cache);
+}
+
+static PoolCache *thread_cache(ObjectPool *pool)
+{
+    PoolCache *cache = thread_caches[pool->id];
+    if (cache != NULL)
+        return cache;
+
+    cache = calloc(1, sizeof(PoolCache));
+    if (cache == NULL)
+        return NULL;
+    cache->pool = pool;
+    pthread_mutex_lock(&pool->lock);
+    cache->next = pool->caches;
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->lock);
+    pthread_setspecific(pool->key, cache);
+    thread_caches[pool->id] = cache;
+    return cache;
+}
+
+int object_pool_init(ObjectPool *pool, const char *name, size_t size)
+{
+    if (pool_count == POOL_MAX)
+        return -1;
+    memset(pool, 0, sizeof(ObjectPool));
+    pool->name = name;
+    if (size < sizeof(void *))
+        size = sizeof(void *); // Room for the free-list link
+    pool->size = (size + 15) & ~(size_t)15; // malloc's alignment
+    pool->id = pool_count++;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pthread_key_create(&pool->key, cache_release) == 0 ? 0 : -1;
+}
+
+// Takes a batch from the depot, carving a new slab if it is empty
+static void cache_refill(ObjectPool *pool, PoolCache *cache)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (pool->depot == NULL)
+    {
+        char *slab = malloc(POOL_SLAB_OBJECTS * pool->size);
+        for (int i = 0; slab != NULL && i < POOL_SLAB_OBJECTS; i++)
+        {
+            *(void **)(slab + i * pool->size) = pool->depot;
+            pool->depot = slab + i * pool->size;
+        }
+        if (slab != NULL)
+        {
+            pool->depot_count += POOL_SLAB_OBJECTS;
+            pool->slabs++;
+        }
+    }
+    int moved = move_objects(&pool->depot, &cache->free_list, POOL_BATCH);
+    pool->depot_count -= moved;
+    pthread_mutex_unlock(&pool->lock);
+    cache->count += moved;
+    cache->stats.refills++;
+}
+
+void *object_pool_get(ObjectPool *pool)
+{
+    PoolCache *cache = thread_cache(pool);
+    if (cache == NULL)
+        return malloc(pool->size); // Still goes back through object_pool_put
+    cache->stats.gets++;
+    if (cache->count > 0)
+        cache->stats.cache_hits++;
+    else
+        cache_refill(pool, cache);
+
+    void *object = cache->free_list;
+    if (object == NULL)
+        return NULL;
+    cache->free_list = *(void **)object;
+    cache->count--;
+    return object;
+}
+
+void object_pool_put(ObjectPool *pool, void *object)
+{
+    PoolCache *cache = thread_cache(pool);
+    if (cache == NULL)
+    {
+        pthread_mutex_lock(&pool->lock);
+        *(void **)object = pool->depot;
+        pool->depot = object;
+        pool->depot_count++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+    cache->stats.puts++;
+    *(void **)object = cache->free_list;
+    cache->free_list = object;
+
+    // A thread that only frees (a worker, for requests) hands its surplus back
+    if (++cache->count >= 2 * POOL_BATCH)
+    {
+        pthread_mutex_lock(&pool->lock);
+        int moved = move_objects(&cache->free_list, &pool->depot, POOL_BATCH);
+        pool->depot_count += moved;
+        pthread_mutex_unlock(&pool->lock);
+        cache->count -= moved;
+        cache->stats.flushes++;
+    }
+}
+
+void object_pool_stats(ObjectPool *pool, PoolStats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->retired;
+    stats->objects = pool->slabs * POOL_SLAB_OBJECTS;
+    for (PoolCache *cache = pool->caches; cache != NULL; cache = cache->next)
+        add_stats(stats, &cache->stats);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,53 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define POOL_MAX 4           // Pools per process; each thread has a cache slot for every one
+#define POOL_BATCH 32        // Objects moved between a thread's cache and the depot at a time
+#define POOL_SLAB_OBJECTS 64 // Objects carved out of each malloc() once the depot runs dry
+
+typedef struct PoolCache PoolCache;
+
+typedef struct
+{
+    unsigned long gets;
+    unsigned long puts;
+    unsigned long cache_hits; // Gets served from the thread's own cache, without the lock
+    unsigned long refills;    // Batches a thread took from the depot
+    unsigned long flushes;    // Batches a thread gave back to the depot
+    unsigned long objects;    // Carved out of slabs so far, pool-wide
+} PoolStats;
+
+// Fixed-size objects recycled instead of going back to malloc. Each thread
+// gets and puts through its own cache without locking; only a batch at a
+// time moves to or from the shared depot under the pool's lock, so objects
+// allocated on one thread and freed on another (a request going from an
+// intake thread to a worker, a command from a worker to a reactor) flow
+// back in bulk. Slabs are never returned to malloc.
+typedef struct
+{
+    const char *name;
+    size_t size;
+    int id;
+    pthread_key_t key; // Hands the cache of an exiting thread back to the depot
+    pthread_mutex_t lock;
+    void *depot; // Free objects no thread holds, linked through their first word
+    int depot_count;
+    PoolCache *caches; // Live thread caches, for the stats
+    PoolStats retired; // Counters of the threads that have exited
+    unsigned long slabs;
+} ObjectPool;
+
+// Returns 0, or -1 once POOL_MAX pools exist
+int object_pool_init(ObjectPool *pool, const char *name, size_t size);
+
+// An object of the pool's size with undefined contents, or NULL if out of memory
+void *object_pool_get(ObjectPool *pool);
+void object_pool_put(ObjectPool *pool, void *object);
+
+// Counters summed over every thread; a snapshot while they are running
+void object_pool_stats(ObjectPool *pool, PoolStats *stats);
+
+#endif
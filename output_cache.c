@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "output_cache.h"
+#include "spawn.h"
+
+#define CACHE_BUCKETS 256
+#define CACHE_ENTRY_SHARE 4 // One entry may use at most this fraction of the cache
+
+typedef struct CacheEntry
+{
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev; // Towards the most recently used entry
+    struct CacheEntry *lru_next;
+    uint32_t hash;
+    long expires_ms;
+    CachedOutput *output;
+    char command[];
+} CacheEntry;
+
+static char **prefixes; // NULL-terminated allow-list; NULL while the cache is off
+static int cache_ttl_ms;
+static size_t cache_max_bytes;
+static CacheEntry *buckets[CACHE_BUCKETS];
+static CacheEntry *lru_head; // Most recently used
+static CacheEntry *lru_tail;
+static size_t cached_bytes;
+static int entry_count;
+static unsigned long hit_count;
+static unsigned long miss_count;
+static unsigned long eviction_count;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a
+static uint32_t hash_command(const char *command)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)command; *c != '\0'; c++)
+        hash = (hash ^ *c) * 16777619u;
+    return hash;
+}
+
+int output_cache_init(const char *allow_list, int ttl_ms, size_t max_bytes)
+{
+    int count = 1;
+    for (const char *c = allow_list; *c != '\0'; c++)
+        count += *c == ',';
+
+    char *copy = strdup(allow_list);
+    prefixes = calloc(count + 1, sizeof(char *));
+    if (copy == NULL || prefixes == NULL)
+        return -1;
+
+    int n = 0;
+    for (char *prefix = strtok(copy, ","); prefix != NULL; prefix = strtok(NULL, ","))
+        prefixes[n++] = prefix;
+    cache_ttl_ms = ttl_ms;
+    cache_max_bytes = max_bytes;
+    return 0;
+}
+
+int output_cache_enabled(void)
+{
+    return prefixes != NULL;
+}
+
+static int is_cacheable(const char *command)
+{
+    if (prefixes == NULL || !is_simple_command(command))
+        return 0;
+    for (int i = 0; prefixes[i] != NULL; i++)
+    {
+        size_t length = strlen(prefixes[i]);
+        // "ls" allows "ls" and "ls /tmp" but not "lsof"
+        if (strncmp(command, prefixes[i], length) == 0 && (command[length] == '\0' || command[length] == ' ' || prefixes[i][length - 1] == ' '))
+            return 1;
+    }
+    return 0;
+}
+
+void output_cache_put(CachedOutput *output)
+{
+    if (__atomic_sub_fetch(&output->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(output);
+}
+
+static void lru_unlink(CacheEntry *entry)
+{
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(CacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL)
+        lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL)
+        lru_tail = entry;
+}
+
+// Caller holds cache_lock
+static void entry_remove(CacheEntry *entry)
+{
+    CacheEntry **link = &buckets[entry->hash % CACHE_BUCKETS];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+
+    cached_bytes -= entry->output->length;
+    entry_count--;
+    output_cache_put(entry->output);
+    free(entry);
+}
+
+static CacheEntry *entry_find(const char *command, uint32_t hash)
+{
+    CacheEntry *entry = buckets[hash % CACHE_BUCKETS];
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->command, command) != 0))
+        entry = entry->hash_next;
+    return entry;
+}
+
+CachedOutput *output_cache_get(const char *command)
+{
+    if (!is_cacheable(command))
+        return NULL;
+
+    uint32_t hash = hash_command(command);
+    CachedOutput *output = NULL;
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = entry_find(command, hash);
+    if (entry != NULL && entry->expires_ms <= now_ms())
+    {
+        entry_remove(entry);
+        entry = NULL;
+    }
+    if (entry != NULL)
+    {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        output = entry->output;
+        __atomic_add_fetch(&output->refs, 1, __ATOMIC_RELAXED);
+        hit_count++;
+    }
+    else
+        miss_count++;
+    pthread_mutex_unlock(&cache_lock);
+    return output;
+}
+
+OutputCapture *output_capture_begin(const char *command)
+{
+    if (!is_cacheable(command))
+        return NULL;
+
+    OutputCapture *capture = calloc(1, sizeof(OutputCapture));
+    if (capture == NULL || (capture->command = strdup(command)) == NULL)
+    {
+        free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+void output_capture_append(OutputCapture *capture, const char *data, size_t length)
+{
+    if (capture->overflow)
+        return;
+    if (capture->length + length > cache_max_bytes / CACHE_ENTRY_SHARE)
+    {
+        capture->overflow = 1;
+        return;
+    }
+    if (capture->length + length > capture->capacity)
+    {
+        size_t capacity = capture->capacity == 0 ? 4096 : capture->capacity;
+        while (capacity < capture->length + length)
+            capacity *= 2;
+        char *grown = realloc(capture->data, capacity);
+        if (grown == NULL)
+        {
+            capture->overflow = 1;
+            return;
+        }
+        capture->data = grown;
+        capture->capacity = capacity;
+    }
+    memcpy(capture->data + capture->length, data, length);
+    capture->length += length;
+}
+
+void output_capture_finish(OutputCapture *capture, int exit_status)
+{
+    size_t command_length = strlen(capture->command) + 1;
+    CacheEntry *entry = NULL;
+    CachedOutput *output = NULL;
+    // Failures may well be transient, so only successful runs are kept
+    if (exit_status == 0 && !capture->overflow)
+    {
+        entry = malloc(sizeof(CacheEntry) + command_length);
+        output = malloc(sizeof(CachedOutput) + capture->length);
+    }
+    if (entry == NULL || output == NULL)
+    {
+        free(entry);
+        free(output);
+        free(capture->command);
+        free(capture->data);
+        free(capture);
+        return;
+    }
+
+    output->refs = 1; // The cache's own reference
+    output->exit_status = exit_status;
+    output->length = capture->length;
+    if (capture->length > 0)
+        memcpy(output->data, capture->data, capture->length);
+    memcpy(entry->command, capture->command, command_length);
+    entry->hash = hash_command(entry->command);
+    entry->output = output;
+
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *stale = entry_find(entry->command, entry->hash);
+    if (stale != NULL)
+        entry_remove(stale); // Several clients missed at once; keep the newest
+    while (lru_tail != NULL && cached_bytes + output->length > cache_max_bytes)
+    {
+        entry_remove(lru_tail);
+        eviction_count++;
+    }
+    entry->expires_ms = now_ms() + cache_ttl_ms;
+    entry->hash_next = buckets[entry->hash % CACHE_BUCKETS];
+    buckets[entry->hash % CACHE_BUCKETS] = entry;
+    lru_push_front(entry);
+    cached_bytes += output->length;
+    entry_count++;
+    pthread_mutex_unlock(&cache_lock);
+
+    free(capture->command);
+    free(capture->data);
+    free(capture);
+}
+
+void output_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *bytes, int *entries)
+{
+    pthread_mutex_lock(&cache_lock);
+    *hits = hit_count;
+    *misses = miss_count;
+    *evictions = eviction_count;
+    *bytes = cached_bytes;
+    *entries = entry_count;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef OUTPUT_CACHE_H
+#define OUTPUT_CACHE_H
+
+#include <stddef.h>
+
+#define DEFAULT_CACHE_TTL_MS 2000
+#define DEFAULT_CACHE_KB 4096
+
+// Output of one successful run of a cacheable command. Immutable and
+// reference-counted, so a hit is sent without holding the cache lock.
+typedef struct
+{
+    int refs;
+    int exit_status;
+    size_t length;
+    char data[];
+} CachedOutput;
+
+// Collects a command's output while it runs, for output_capture_finish()
+typedef struct
+{
+    char *command;
+    char *data;
+    size_t length;
+    size_t capacity;
+    int overflow; // Output grew past what the cache may hold; not stored
+} OutputCapture;
+
+// Turns the cache on for simple commands (see is_simple_command()) that
+// start with one of the comma-separated prefixes in allow_list, as whole
+// words. Entries live for ttl_ms; the least recently used ones are evicted
+// to keep the cached output under max_bytes. Returns -1 without memory.
+int output_cache_init(const char *allow_list, int ttl_ms, size_t max_bytes);
+
+int output_cache_enabled(void);
+
+// Returns a reference to the fresh output of command, or NULL (a miss)
+CachedOutput *output_cache_get(const char *command);
+void output_cache_put(CachedOutput *output);
+
+// Starts capturing the output of command if it may be cached, else NULL
+OutputCapture *output_capture_begin(const char *command);
+void output_capture_append(OutputCapture *capture, const char *data, size_t length);
+
+// Stores the captured output if the command succeeded, then frees capture
+void output_capture_finish(OutputCapture *capture, int exit_status);
+
+void output_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions, size_t *bytes, int *entries);
+
+#endif
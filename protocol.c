@@ -0,0 +1,279 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/msg.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+
+// Length and terminator checks shared by every transport
+static int frame_check(Message *msg, ssize_t received)
+{
+    if ((size_t)received < MSG_HEADER_SIZE || msg->length < 0 || msg->length > MAX_CMD_LEN || MSG_FRAME_SIZE(msg->length) != (size_t)received)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    msg->command[msg->length] = '\0';
+    return 0;
+}
+
+int msg_send_frame(int queue, const Message *msg, int msgflg)
+{
+    int length = msg->length;
+    if (length < 0 || length > MAX_CMD_LEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return msgsnd(queue, msg, MSG_FRAME_SIZE(length), msgflg);
+}
+
+int msg_recv_frame(int queue, Message *msg, long type, int msgflg)
+{
+    ssize_t received = msgrcv(queue, msg, MQ_FRAME_MAX, type, msgflg);
+    if (received == -1)
+        return -1;
+    return frame_check(msg, received);
+}
+
+int mq_send_frame(mqd_t mq, const Message *msg)
+{
+    int length = msg->length;
+    if (length < 0 || length > MAX_CMD_LEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return mq_send(mq, (const char *)&msg->client_pid, MSG_FRAME_SIZE(length), 0);
+}
+
+int mq_recv_frame(mqd_t mq, Message *msg)
+{
+    ssize_t received = mq_receive(mq, (char *)&msg->client_pid, MQ_FRAME_MAX, NULL);
+    if (received == -1)
+        return -1;
+    msg->msg_type = 1;
+    return frame_check(msg, received);
+}
+
+int sock_send_frame(int sock, const Message *msg, int fd, int flags)
+{
+    int length = msg->length;
+    if (length < 0 || length > MAX_CMD_LEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct iovec iov = {(void *)&msg->client_pid, MSG_FRAME_SIZE(length)};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr header = {0};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    if (fd != -1)
+    {
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &header, flags | MSG_NOSIGNAL) == -1 ? -1 : 0;
+}
+
+int sock_recv_frame(int sock, Message *msg, int *fd, int flags)
+{
+    struct iovec iov = {&msg->client_pid, MQ_FRAME_MAX};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr header = {0};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+
+    *fd = -1;
+    ssize_t received = recvmsg(sock, &header, flags | MSG_CMSG_CLOEXEC);
+    if (received == -1)
+        return -1;
+    if (received == 0)
+    {
+        errno = ECONNRESET;
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    msg->msg_type = 1;
+    if (frame_check(msg, received) == -1)
+    {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void put_u32(char *p, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static uint32_t get_u32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+ssize_t tcp_frame_encode(const Message *msg, char *frame)
+{
+    int length = msg->length;
+    if (length < 0 || length > MAX_CMD_LEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    put_u32(frame, TCP_HEADER_SIZE + length);
+    char *header = frame + TCP_FRAME_PREFIX;
+    put_u32(header, (uint32_t)msg->client_pid);
+    put_u32(header + 4, (uint32_t)msg->request_id);
+    put_u32(header + 8, (uint32_t)msg->seq);
+    put_u32(header + 12, (uint32_t)msg->flags);
+    put_u32(header + 16, (uint32_t)msg->status);
+    put_u32(header + 20, (uint32_t)length);
+    memcpy(header + TCP_HEADER_SIZE, msg->command, length);
+    return TCP_FRAME_PREFIX + TCP_HEADER_SIZE + length;
+}
+
+// Checks the size prefix of a frame; returns 0, or -1 with errno = EBADMSG
+static int tcp_size_check(uint32_t size)
+{
+    if (size < TCP_HEADER_SIZE || size > TCP_HEADER_SIZE + MAX_CMD_LEN)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+// Decodes the size bytes of header and payload that follow a frame's prefix
+static int tcp_frame_parse(const char *frame, uint32_t size, Message *msg)
+{
+    msg->msg_type = 1;
+    msg->client_pid = (int32_t)get_u32(frame);
+    msg->request_id = (int32_t)get_u32(frame + 4);
+    msg->seq = (int32_t)get_u32(frame + 8);
+    msg->flags = (int32_t)get_u32(frame + 12);
+    msg->status = (int32_t)get_u32(frame + 16);
+    msg->length = (int32_t)get_u32(frame + 20);
+    if (msg->length < 0 || (uint32_t)msg->length != size - TCP_HEADER_SIZE)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+    memcpy(msg->command, frame + TCP_HEADER_SIZE, msg->length);
+    msg->command[msg->length] = '\0';
+    return 0;
+}
+
+int tcp_send_frame(int sock, const Message *msg)
+{
+    char frame[TCP_FRAME_SIZE_MAX];
+    ssize_t total = tcp_frame_encode(msg, frame);
+    if (total == -1)
+        return -1;
+    for (ssize_t sent = 0; sent < total;)
+    {
+        ssize_t n = send(sock, frame + sent, total - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        sent += n;
+    }
+    return 0;
+}
+
+// Reads exactly length bytes, or fails with ECONNRESET at end of stream
+static int read_exactly(int sock, void *buffer, size_t length)
+{
+    for (size_t got = 0; got < length;)
+    {
+        ssize_t n = recv(sock, (char *)buffer + got, length - got, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        if (n == 0)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+int tcp_recv_frame(int sock, Message *msg)
+{
+    char frame[TCP_FRAME_SIZE_MAX];
+    if (read_exactly(sock, frame, TCP_FRAME_PREFIX) == -1)
+        return -1;
+    uint32_t size = get_u32(frame);
+    if (tcp_size_check(size) == -1 || read_exactly(sock, frame, size) == -1)
+        return -1;
+    return tcp_frame_parse(frame, size, msg);
+}
+
+ssize_t tcp_frame_decode(const char *input, size_t length, Message *msg)
+{
+    if (length < TCP_FRAME_PREFIX)
+        return 0;
+    uint32_t size = get_u32(input);
+    if (tcp_size_check(size) == -1)
+        return -1;
+    if (length < TCP_FRAME_PREFIX + size)
+        return 0;
+    if (tcp_frame_parse(input + TCP_FRAME_PREFIX, size, msg) == -1)
+        return -1;
+    return TCP_FRAME_PREFIX + size;
+}
+
+int msg_send_fragmented(const Message *header, const char *data, size_t length, FrameSender send, void *ctx)
+{
+    Message frame;
+    int frames = 0;
+
+    memcpy(&frame, header, offsetof(Message, command));
+
+    do
+    {
+        size_t chunk = length < MAX_CMD_LEN ? length : MAX_CMD_LEN;
+        frame.seq = header->seq + frames;
+        frame.flags = chunk < length ? (header->flags & ~MSG_FLAG_END) | MSG_FLAG_MORE : header->flags;
+        frame.length = chunk;
+        memcpy(frame.command, data, chunk);
+        if (send(ctx, &frame) != 0)
+            return -1;
+        frames++;
+        data += chunk;
+        length -= chunk;
+    } while (length > 0);
+
+    return frames;
+}
@@ -0,0 +1,135 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <mqueue.h>
+
+// Wire definitions shared by the server, the client and the benchmarks
+
+#define MAX_CMD_LEN 1024
+#define SERVER_QUEUE_KEY 1234
+#define RESPONSE_QUEUE_KEY 5678 // Replies, addressed by msg_type = client PID
+
+#define MSG_FLAG_END 0x1 // Last message of a reply, status carries the exit status
+#define MSG_FLAG_SHM 0x2 // REGISTER: the client has created a shared-memory channel
+#define MSG_FLAG_MORE 0x4 // Payload continues in the next message of the stream
+#define MSG_FLAG_INFO 0x8 // Payload is a note from the server, not command output
+#define MSG_FLAG_FD 0x10  // Unix socket only. Request: the client takes the output of a spawned
+                          // command as a pipe. Reply: the pipe's read end came with this frame
+                          // (SCM_RIGHTS); the output is read from it until EOF, and the END
+                          // frame with the exit status follows on the socket
+
+#define STATUS_TRY_LATER 75 // Refused for now (EX_TEMPFAIL), the INFO payload says why
+#define STATUS_TIMED_OUT 124 // Killed for running too long, as timeout(1) reports it
+#define STATUS_OUTPUT_LOST 74 // Some of the output could not be sent (EX_IOERR), whatever the command returned
+
+#define SHM_CHANNEL_NAME "/client_ring_%d" // Formatted with the client's PID
+
+// POSIX queues of the event-loop server (server -E)
+#define SERVER_MQ_NAME "/server_requests"
+#define CLIENT_REPLY_MQ_NAME "/client_reply_%d" // Created by the client, formatted with its PID
+#define MQ_MAX_MESSAGES 10 // Default fs.mqueue.msg_max, the most an unprivileged queue may hold
+
+// Unix socket of the worker-pool server (server -U); SOCK_SEQPACKET, one frame per record
+#define SERVER_SOCKET_PATH "/tmp/client_server.sock"
+
+// TCP front-end of the worker-pool server (server -N [host:]port). Network
+// clients have no PID the server can see, so each connection is known by an
+// ID from TCP_CLIENT_ID_BASE up, above any PID (pid_max is at most 2^22).
+#define TCP_CLIENT_ID_BASE 0x40000000
+
+// Capability bits of the REGISTER ack
+#define CAP_SHM_CHANNEL 0x1 // The client's shared-memory channel is attached and carries replies from now on
+#define CAP_BROADCAST 0x2   // The client's SHUTDOWN broadcast queue exists
+#define CAP_PIPELINE 0x4    // Requests may be pipelined; replies carry request_id and can come back out of order
+#define CAP_EVENT_CORE 0x8  // The server runs the single-threaded event-loop core (-E)
+#define CAP_SHELL_POOL 0x10 // Pre-forked shells run commands that need bash
+#define CAP_FD_PASSING 0x20 // Requests with MSG_FLAG_FD get the output pipe of the commands the server spawns
+
+// Payload of the reply to REGISTER. Status 0 means registered (now or
+// earlier). The ack always comes back over the queue REGISTER was sent on,
+// even for a client asking for a shared-memory channel.
+typedef struct
+{
+    int slot;         // The client's "Client <slot>" position in LIST at the time
+    int capabilities; // CAP_* bits
+} RegisterAck;
+
+typedef struct
+{
+    long msg_type;
+    pid_t client_pid;
+    int request_id; // Picked by the client, echoed on every frame of the reply
+    int seq;    // Position of a reply chunk within its stream
+    int flags;  // MSG_FLAG_* bits
+    int status; // Exit status of the command, valid with MSG_FLAG_END
+    int length; // Bytes used in command (reply chunks are not NUL-terminated)
+    char command[MAX_CMD_LEN + 1]; // Room to NUL-terminate even a full payload; never sent
+} Message;
+
+// Messages are length-prefixed frames: the header says how much of command
+// is in use and only that much is copied. MSG_FRAME_SIZE is the msgsnd size
+// (everything after msg_type) of a frame carrying length payload bytes.
+#define MSG_HEADER_SIZE (offsetof(Message, command) - sizeof(long))
+#define MSG_FRAME_SIZE(length) (MSG_HEADER_SIZE + (size_t)(length))
+
+// Sends msg with only its used payload bytes; returns msgsnd's result
+int msg_send_frame(int queue, const Message *msg, int msgflg);
+
+// Receives one frame of the given type, checks that its length matches what
+// arrived and NUL-terminates the payload. Returns 0, or
+// -1 with errno set (EBADMSG for a malformed frame).
+int msg_recv_frame(int queue, Message *msg, long type, int msgflg);
+
+// The same frames over a POSIX message queue (msg_type is not sent). Queues
+// are created with mq_msgsize = MQ_FRAME_MAX. Both return 0, or -1 with errno
+// set (EAGAIN on a non-blocking queue, EBADMSG for a malformed frame).
+#define MQ_FRAME_MAX MSG_FRAME_SIZE(MAX_CMD_LEN)
+int mq_send_frame(mqd_t mq, const Message *msg);
+int mq_recv_frame(mqd_t mq, Message *msg);
+
+// The same frames over a SOCK_SEQPACKET socket, optionally with a file
+// descriptor attached (fd -1 for none). Receiving sets *fd to the one that
+// came with the frame, close-on-exec, or -1. Both return 0, or -1 with errno
+// set (EAGAIN with MSG_DONTWAIT in flags, ECONNRESET once the peer has hung
+// up, EBADMSG for a malformed frame).
+int sock_send_frame(int sock, const Message *msg, int fd, int flags);
+int sock_recv_frame(int sock, Message *msg, int *fd, int flags);
+
+// The same frames over a TCP stream, where the peer may have another byte
+// order and struct layout, so nothing is sent as a memory image. A frame is
+// its size (header and payload) as a 4-byte big-endian length, then the
+// TCP_HEADER_SIZE-byte header: client_pid, request_id, seq, flags, status
+// and length, in that order, each a big-endian 32-bit two's-complement
+// integer. The length payload bytes follow. Sending writes the whole frame
+// (a short write would leave the stream out of step) and returns 0 or -1.
+// Receiving blocks until a frame is complete; it returns 0, or -1 with errno
+// set (ECONNRESET once the peer has hung up, EBADMSG for a malformed frame).
+#define TCP_FRAME_PREFIX 4
+#define TCP_HEADER_SIZE 24
+#define TCP_FRAME_SIZE_MAX (TCP_FRAME_PREFIX + TCP_HEADER_SIZE + MAX_CMD_LEN)
+int tcp_send_frame(int sock, const Message *msg);
+int tcp_recv_frame(int sock, Message *msg);
+
+// Writes msg as stream bytes into frame (TCP_FRAME_SIZE_MAX bytes) for a
+// caller that sends them itself; returns how many, or -1 with errno = EINVAL
+ssize_t tcp_frame_encode(const Message *msg, char *frame);
+
+// Decodes the frame at the start of length bytes of stream input into msg.
+// Returns how many bytes it took, 0 if the frame is not complete yet, or -1
+// with errno = EBADMSG if the stream is not made of frames.
+ssize_t tcp_frame_decode(const char *input, size_t length, Message *msg);
+
+// Hands each frame to a transport; returns 0 on success
+typedef int (*FrameSender)(void *ctx, const Message *frame);
+
+// Splits length bytes of data into frames of at most MAX_CMD_LEN bytes. The
+// header fields come from header; seq advances by one per frame. The last
+// frame carries header->flags as they are; every other frame carries them
+// without MSG_FLAG_END and with MSG_FLAG_MORE, so MSG_FLAG_INFO marks every
+// frame of the message. Returns the number of frames sent, or -1 if send
+// failed.
+int msg_send_fragmented(const Message *header, const char *data, size_t length, FrameSender send, void *ctx);
+
+#endif
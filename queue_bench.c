@@ -0,0 +1,239 @@
+/******************************************************************************
+ * File: queue_bench.c
+ *
+ * Measures hand-off throughput of the lock-free request ring (mpmc_ring.c)
+ * against a bounded mutex + condition variable queue, which is how the
+ * fair queue hands requests to the workers. Half the threads push and half
+ * pop, through a queue as large as the server's default request queue; with
+ * one thread it pushes and pops in turn. Every item is checked off, so a lost or
+ * duplicated hand-off shows up as an error instead of a number.
+ *
+ * Usage: ./queue_bench [-n items] [-q capacity] [threads ...]
+ *        (defaults: 1000000 items, 256 slots, 1 2 4 8 16 32 64 threads)
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mpmc_ring.h"
+
+#define STOP ((void *)1) // Tells a consumer to finish; items start at 2
+
+// The baseline: one lock around a circular buffer
+typedef struct
+{
+    void **items;
+    int capacity;
+    int head;
+    int depth;
+    unsigned long sleeps;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} MutexQueue;
+
+typedef struct
+{
+    int use_ring;
+    MpmcRing ring;
+    MutexQueue mutex_queue;
+    long items;
+    int producers;
+    int consumers;
+    pthread_barrier_t start;
+    unsigned long checksum; // Sum of every item popped
+} Bench;
+
+static void mutex_queue_init(MutexQueue *q, int capacity)
+{
+    memset(q, 0, sizeof(MutexQueue));
+    q->items = malloc(capacity * sizeof(void *));
+    q->capacity = capacity;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void mutex_queue_push(MutexQueue *q, void *item)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->depth == q->capacity)
+    {
+        q->sleeps++;
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+    q->items[(q->head + q->depth++) % q->capacity] = item;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static void *mutex_queue_pop(MutexQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->depth == 0)
+    {
+        q->sleeps++;
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+    void *item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->depth--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return item;
+}
+
+static void bench_push(Bench *b, void *item)
+{
+    if (b->use_ring)
+        mpmc_ring_push(&b->ring, item);
+    else
+        mutex_queue_push(&b->mutex_queue, item);
+}
+
+static void *bench_pop(Bench *b)
+{
+    return b->use_ring ? mpmc_ring_pop(&b->ring) : mutex_queue_pop(&b->mutex_queue);
+}
+
+typedef struct
+{
+    Bench *bench;
+    long first; // Items first .. last - 1, offset by 2
+    long last;
+} Producer;
+
+static void *producer_thread(void *arg)
+{
+    Producer *p = arg;
+    pthread_barrier_wait(&p->bench->start);
+    for (long i = p->first; i < p->last; i++)
+        bench_push(p->bench, (void *)(i + 2));
+    return NULL;
+}
+
+static void *consumer_thread(void *arg)
+{
+    Bench *b = arg;
+    unsigned long sum = 0;
+    pthread_barrier_wait(&b->start);
+    void *item;
+    while ((item = bench_pop(b)) != STOP)
+        sum += (unsigned long)item - 2;
+    __atomic_add_fetch(&b->checksum, sum, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns millions of hand-offs per second, or -1 if items went missing
+static double run(Bench *b, int threads, unsigned long *sleeps)
+{
+    b->checksum = 0;
+    double start, elapsed;
+    if (threads == 1)
+    {
+        start = now_s();
+        for (long i = 0; i < b->items; i++)
+        {
+            bench_push(b, (void *)(i + 2));
+            b->checksum += (unsigned long)bench_pop(b) - 2;
+        }
+        elapsed = now_s() - start;
+    }
+    else
+    {
+        b->producers = threads / 2;
+        b->consumers = threads - b->producers;
+        pthread_t ids[threads];
+        Producer producers[b->producers];
+        pthread_barrier_init(&b->start, NULL, threads + 1);
+        for (int i = 0; i < b->producers; i++)
+        {
+            producers[i] = (Producer){b, b->items * i / b->producers, b->items * (i + 1) / b->producers};
+            pthread_create(&ids[i], NULL, producer_thread, &producers[i]);
+        }
+        for (int i = 0; i < b->consumers; i++)
+            pthread_create(&ids[b->producers + i], NULL, consumer_thread, b);
+
+        pthread_barrier_wait(&b->start);
+        start = now_s();
+        for (int i = 0; i < b->producers; i++)
+            pthread_join(ids[i], NULL);
+        for (int i = 0; i < b->consumers; i++)
+            bench_push(b, STOP);
+        for (int i = 0; i < b->consumers; i++)
+            pthread_join(ids[b->producers + i], NULL);
+        elapsed = now_s() - start;
+        pthread_barrier_destroy(&b->start);
+    }
+
+    *sleeps = b->use_ring ? b->ring.empty_sleeps + b->ring.full_sleeps : b->mutex_queue.sleeps;
+    unsigned long expected = (unsigned long)b->items * (b->items - 1) / 2;
+    return b->checksum == expected ? b->items / elapsed / 1e6 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    long items = 1000000;
+    int capacity = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:q:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            items = atol(optarg);
+            break;
+        case 'q':
+            capacity = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n items] [-q capacity] [threads ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int default_threads[] = {1, 2, 4, 8, 16, 32, 64};
+    int count = argc > optind ? argc - optind : (int)(sizeof(default_threads) / sizeof(int));
+    printf("%ld items per run through %d slots, %ld CPUs\n", items, capacity, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %12s %12s %14s %14s\n", "threads", "ring_Mops", "mutex_Mops", "ring_sleeps", "mutex_sleeps");
+    for (int i = 0; i < count; i++)
+    {
+        int threads = argc > optind ? atoi(argv[optind + i]) : default_threads[i];
+        if (threads < 1)
+            continue;
+
+        Bench *b = calloc(1, sizeof(Bench));
+        b->items = items;
+        mpmc_ring_init(&b->ring, capacity);
+        mutex_queue_init(&b->mutex_queue, capacity);
+
+        unsigned long ring_sleeps, mutex_sleeps;
+        b->use_ring = 1;
+        double ring = run(b, threads, &ring_sleeps);
+        b->use_ring = 0;
+        double mutex = run(b, threads, &mutex_sleeps);
+        if (ring < 0 || mutex < 0)
+        {
+            fprintf(stderr, "%d threads: items lost or duplicated by the %s\n", threads, ring < 0 ? "ring" : "mutex queue");
+            return 1;
+        }
+        printf("%8d %12.2f %12.2f %14lu %14lu\n", threads, ring, mutex, ring_sleeps, mutex_sleeps);
+
+        mpmc_ring_destroy(&b->ring);
+        free(b->mutex_queue.items);
+        free(b);
+    }
+    return 0;
+}
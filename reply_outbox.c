@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "reply_outbox.h"
+
+// A reply frame waiting for room at its client
+typedef struct OutboxFrame
+{
+    struct OutboxFrame *next;
+    Message frame; // Only the used part of command is allocated
+} OutboxFrame;
+
+// Exists only while the client has frames queued
+typedef struct ClientOutbox
+{
+    struct ClientOutbox *next; // Stripe chain
+    pid_t pid;
+    OutboxFrame *head;
+    OutboxFrame *tail;
+    int length;
+    int throttled; // Reached OUTBOX_HIGH_WATER; drained() is due at OUTBOX_LOW_WATER
+} ClientOutbox;
+
+// The stripe's lock is held across a send too, so two threads replying to
+// the same client cannot overtake each other
+typedef struct
+{
+    pthread_mutex_t lock;
+    ClientOutbox *clients;
+} OutboxStripe;
+
+static OutboxSendFn send_now;
+static OutboxDrainFn drained;
+static OutboxStripe stripes[OUTBOX_STRIPES];
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+static int waiting_clients; // Outboxes with frames, under flusher_lock
+static unsigned long frames_deferred;
+static unsigned long frames_dropped;
+
+static ClientOutbox *outbox_find(OutboxStripe *stripe, pid_t pid)
+{
+    ClientOutbox *box = stripe->clients;
+    while (box != NULL && box->pid != pid)
+        box = box->next;
+    return box;
+}
+
+// Queues a copy of frame behind whatever the client already has waiting;
+// caller holds the stripe's lock. Returns 0, or -1 without memory for it.
+static int outbox_append(OutboxStripe *stripe, ClientOutbox *box, const Message *frame)
+{
+    size_t size = offsetof(OutboxFrame, frame) + sizeof(long) + MSG_FRAME_SIZE(frame->length);
+    OutboxFrame *pending = malloc(size);
+    int created = box == NULL;
+    if (created)
+        box = calloc(1, sizeof(ClientOutbox));
+    if (pending == NULL || box == NULL)
+    {
+        free(pending);
+        if (created)
+            free(box);
+        __atomic_add_fetch(&frames_dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if (created)
+    {
+        box->pid = frame->client_pid;
+        box->next = stripe->clients;
+        stripe->clients = box;
+    }
+
+    __atomic_add_fetch(&frames_deferred, 1, __ATOMIC_RELAXED);
+    memcpy(&pending->frame, frame, size - offsetof(OutboxFrame, frame));
+    pending->next = NULL;
+    if (box->tail != NULL)
+        box->tail->next = pending;
+    else
+        box->head = pending;
+    box->tail = pending;
+    if (++box->length >= OUTBOX_HIGH_WATER)
+        box->throttled = 1;
+
+    if (created)
+    {
+        pthread_mutex_lock(&flusher_lock);
+        if (waiting_clients++ == 0)
+            pthread_cond_signal(&flusher_wake);
+        pthread_mutex_unlock(&flusher_lock);
+    }
+    return 0;
+}
+
+int reply_outbox_send(const Message *frame)
+{
+    OutboxStripe *stripe = &stripes[(unsigned)frame->client_pid % OUTBOX_STRIPES];
+    pthread_mutex_lock(&stripe->lock);
+    ClientOutbox *box = outbox_find(stripe, frame->client_pid);
+    int rc = box == NULL ? send_now(frame) : 1;
+    if (rc == 1)
+        rc = outbox_append(stripe, box, frame);
+    pthread_mutex_unlock(&stripe->lock);
+    return rc == -1 ? -1 : 0;
+}
+
+int reply_outbox_backlog(pid_t pid)
+{
+    OutboxStripe *stripe = &stripes[(unsigned)pid % OUTBOX_STRIPES];
+    pthread_mutex_lock(&stripe->lock);
+    ClientOutbox *box = outbox_find(stripe, pid);
+    int length = box != NULL ? box->length : 0;
+    pthread_mutex_unlock(&stripe->lock);
+    return length;
+}
+
+// Sends what the stripe's clients have room for; returns how many frames went
+static int stripe_flush(OutboxStripe *stripe)
+{
+    int sent = 0, emptied = 0, relieved = 0;
+    pthread_mutex_lock(&stripe->lock);
+    ClientOutbox **link = &stripe->clients;
+    while (*link != NULL)
+    {
+        ClientOutbox *box = *link;
+        while (box->head != NULL && send_now(&box->head->frame) != 1)
+        {
+            OutboxFrame *pending = box->head;
+            box->head = pending->next;
+            box->length--;
+            free(pending);
+            sent++;
+        }
+        if (box->throttled && box->length <= OUTBOX_LOW_WATER)
+        {
+            box->throttled = 0;
+            relieved = 1;
+        }
+        if (box->head != NULL)
+        {
+            link = &box->next;
+            continue;
+        }
+        *link = box->next;
+        free(box);
+        emptied++;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+
+    if (emptied > 0)
+    {
+        pthread_mutex_lock(&flusher_lock);
+        waiting_clients -= emptied;
+        pthread_mutex_unlock(&flusher_lock);
+    }
+    if (relieved)
+        drained();
+    return sent;
+}
+
+static void *flusher_thread(void *arg)
+{
+    (void)arg;
+    int pause_us = OUTBOX_RETRY_MIN_US;
+    while (1)
+    {
+        pthread_mutex_lock(&flusher_lock);
+        while (waiting_clients == 0)
+            pthread_cond_wait(&flusher_wake, &flusher_lock);
+        pthread_mutex_unlock(&flusher_lock);
+
+        int sent = 0;
+        for (int i = 0; i < OUTBOX_STRIPES; i++)
+            sent += stripe_flush(&stripes[i]);
+
+        // Clients that read again are served within OUTBOX_RETRY_MIN_US, one
+        // that stopped costs no more than a wake-up every OUTBOX_RETRY_MAX_US
+        if (sent > 0)
+            pause_us = OUTBOX_RETRY_MIN_US;
+        else
+        {
+            usleep(pause_us);
+            pause_us = pause_us * 2 < OUTBOX_RETRY_MAX_US ? pause_us * 2 : OUTBOX_RETRY_MAX_US;
+        }
+    }
+    return NULL;
+}
+
+int reply_outbox_init(OutboxSendFn send, OutboxDrainFn on_drained)
+{
+    send_now = send;
+    drained = on_drained;
+    for (int i = 0; i < OUTBOX_STRIPES; i++)
+        pthread_mutex_init(&stripes[i].lock, NULL);
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, flusher_thread, NULL);
+    pthread_attr_destroy(&attr);
+    return err == 0 ? 0 : -1;
+}
+
+void reply_outbox_stats(unsigned long *deferred, unsigned long *dropped, int *clients)
+{
+    *deferred = __atomic_load_n(&frames_deferred, __ATOMIC_RELAXED);
+    *dropped = __atomic_load_n(&frames_dropped, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&flusher_lock);
+    *clients = waiting_clients;
+    pthread_mutex_unlock(&flusher_lock);
+}
@@ -0,0 +1,41 @@
+#ifndef REPLY_OUTBOX_H
+#define REPLY_OUTBOX_H
+
+#include "protocol.h"
+
+#define OUTBOX_STRIPES 64
+#define OUTBOX_HIGH_WATER 64    // Frames waiting for a client at which its commands' output stops being read
+#define OUTBOX_LOW_WATER 16     // ... and what it has to get down to before they are told to go on
+#define OUTBOX_RETRY_MIN_US 100 // First pause of the flusher when no client took anything
+#define OUTBOX_RETRY_MAX_US 10000
+
+// Tries to send frame without blocking. Returns 0 once it is taken care of
+// (sent, or dropped because its client is gone), 1 while the client has no
+// room for it, or -1 on an error that dropping the frame is all we can do about.
+typedef int (*OutboxSendFn)(const Message *frame);
+
+// Called from the flusher thread when a client that had OUTBOX_HIGH_WATER
+// frames waiting is down to OUTBOX_LOW_WATER
+typedef void (*OutboxDrainFn)(void);
+
+// Replies of the worker-pool server, sent so that no thread ever waits on a
+// client: a frame goes straight out when the client has room and nothing
+// queued, and otherwise joins the client's outbox, in order, which a
+// flusher thread retries with a growing pause while nobody makes progress.
+// Nothing is dropped for a client that is still there, so whoever produces
+// a client's output checks reply_outbox_backlog() and stops at
+// OUTBOX_HIGH_WATER until drained() says there is room again. The -E core
+// does the same for its POSIX queues with EPOLLOUT instead.
+// Returns 0, or -1 if the flusher thread cannot be started.
+int reply_outbox_init(OutboxSendFn send, OutboxDrainFn drained);
+
+// Sends frame now or queues a copy; never blocks. Returns 0, or -1 if the
+// frame failed or there was no memory to queue it.
+int reply_outbox_send(const Message *frame);
+
+// Frames waiting for the client, 0 when it is keeping up
+int reply_outbox_backlog(pid_t pid);
+
+void reply_outbox_stats(unsigned long *deferred, unsigned long *dropped, int *clients);
+
+#endif
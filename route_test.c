@@ -0,0 +1,193 @@
+/******************************************************************************
+ * File: route_test.c
+ *
+ * Checks that replies reach the client that asked, under load. Forks N
+ * clients that REGISTER at the same time and each send a run of
+ * "echo <pid>-<n>" requests tagged with request id n. Every reply frame
+ * must name the client and the request it answers, and the output must be
+ * the client's own token; anything else counts as misdelivered.
+ *
+ * Reports the p99 round-trip latency of each client (median and worst
+ * across clients) and of all requests together. Exits 1 if any reply was
+ * misdelivered, a client failed to connect, or the p99 of all requests is
+ * above -p milliseconds, so it can gate a build (make loadtest).
+ *
+ * Usage: ./route_test [-c clients] [-n requests_per_client] [-t sysv|shm|mq] [-p max_p99_ms]
+ *        (defaults: 200 clients, 50 requests each, over sysv, no latency limit)
+ *        Start the server first, with its output redirected to /dev/null.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "protocol.h"
+#include "bench_client.h"
+
+#define MAX_REQUESTS 1000
+
+typedef struct
+{
+    int connected;
+    int misrouted;  // Frames naming another client or request
+    int wrong;      // Replies that completed with somebody else's output
+    int busy;       // Refused with STATUS_TRY_LATER; not a routing error
+    int failed;     // Any other non-zero status
+    int completed;
+    double latency_us[MAX_REQUESTS];
+} ClientResult;
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *values, int count, double q)
+{
+    if (count == 0)
+        return 0;
+    qsort(values, count, sizeof(double), compare_double);
+    int index = (int)(q * count);
+    return values[index < count ? index : count - 1];
+}
+
+static void run_client(ClientResult *result, const char *transport, int requests, double start_at)
+{
+    if (bench_connect(transport) == -1)
+        _exit(1);
+    bench_send("REGISTER");
+    bench_wait_reply();
+    result->connected = 1;
+
+    // Everyone starts together, so the replies really do interleave
+    while (bench_now_us() < start_at)
+        usleep(1000);
+
+    for (int n = 1; n <= requests; n++)
+    {
+        char command[96], expected[64], output[256];
+        snprintf(expected, sizeof(expected), "%d-%d", getpid(), n);
+        snprintf(command, sizeof(command), "echo %s", expected);
+
+        double sent = bench_now_us();
+        bench_send_tagged(command, n);
+        int status = bench_wait_output(n, output, sizeof(output), &result->misrouted);
+        result->latency_us[result->completed++] = bench_now_us() - sent;
+
+        output[strcspn(output, "\n")] = '\0';
+        if (status == STATUS_TRY_LATER)
+            result->busy++;
+        else if (status != 0)
+            result->failed++;
+        else if (strcmp(output, expected) != 0)
+            result->wrong++;
+    }
+
+    bench_send("EXIT");
+    bench_wait_reply();
+    bench_disconnect();
+}
+
+int main(int argc, char *argv[])
+{
+    int clients = 200;
+    int requests = 50;
+    const char *transport = "sysv";
+    double max_p99_ms = 0; // 0: latency is only reported
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:t:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 't':
+            transport = optarg;
+            break;
+        case 'p':
+            max_p99_ms = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c clients] [-n requests_per_client] [-t sysv|shm|mq] [-p max_p99_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (clients < 1 || requests < 1 || requests > MAX_REQUESTS)
+    {
+        fprintf(stderr, "%s: need at least 1 client and 1 to %d requests each\n", argv[0], MAX_REQUESTS);
+        return 1;
+    }
+    if (bench_connect(transport) == -1)
+    {
+        perror("connect (is the server running? -t mq needs server -E)");
+        return 1;
+    }
+    bench_disconnect();
+
+    ClientResult *results = mmap(NULL, clients * sizeof(ClientResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    double start_at = bench_now_us() + 200000 + clients * 2000.0; // Time for every client to fork and REGISTER
+    for (int c = 0; c < clients; c++)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0)
+        {
+            run_client(&results[c], transport, requests, start_at);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    int connected = 0, misrouted = 0, wrong = 0, busy = 0, failed = 0, total = 0;
+    double *client_p99 = malloc(clients * sizeof(double));
+    double *all = malloc((size_t)clients * requests * sizeof(double));
+    for (int c = 0; c < clients; c++)
+    {
+        ClientResult *r = &results[c];
+        connected += r->connected;
+        misrouted += r->misrouted;
+        wrong += r->wrong;
+        busy += r->busy;
+        failed += r->failed;
+        memcpy(all + total, r->latency_us, r->completed * sizeof(double));
+        total += r->completed;
+        client_p99[c] = percentile(r->latency_us, r->completed, 0.99);
+    }
+
+    printf("route_test: %d clients over %s, %d requests each\n", clients, transport, requests);
+    printf("connected %d, replies %d, misdelivered frames %d, wrong output %d, busy %d, failed %d\n", connected, total, misrouted, wrong, busy, failed);
+    double p99 = percentile(all, total, 0.99);
+    printf("per-client p99: median %.1f us, worst %.1f us; all requests p50 %.1f us, p99 %.1f us\n", percentile(client_p99, clients, 0.5),
+           percentile(client_p99, clients, 1.0), percentile(all, total, 0.5), p99);
+
+    int ok = connected == clients && misrouted == 0 && wrong == 0;
+    if (max_p99_ms > 0 && p99 > max_p99_ms * 1000)
+    {
+        printf("p99 %.1f ms is above the %.1f ms limit\n", p99 / 1000, max_p99_ms);
+        ok = 0;
+    }
+    printf("%s\n", ok ? "PASS: every reply reached the client that asked" : "FAIL");
+    free(client_p99);
+    free(all);
+    munmap(results, clients * sizeof(ClientResult));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <time.h>
+
+#include "shell_pool.h"
+#include "spawn.h"
+
+#define SHELL_TOKEN_LEN 32
+#define SHELL_READ_SIZE 4096
+#define SHELL_STATUS_MAX (SHELL_TOKEN_LEN + 16) // "<token> <status>\n"
+
+struct ShellWorker
+{
+    pid_t pid;     // -1 while the worker is down
+    int cmd_fd;    // Write end of the worker's stdin
+    int out_fd;    // Read end of the worker's stdout and stderr, non-blocking
+    int status_fd; // Read end of the worker's fd 3, which only it writes status lines to
+    int commands;  // Commands run since the worker started
+    int broken;    // Protocol lost (crash, write error); restart before reuse
+    char token[SHELL_TOKEN_LEN + 1];
+    ShellWorker *next_idle;
+};
+
+extern char **environ;
+
+static ShellWorker *workers;
+static int pool_size;
+static int recycle_after = DEFAULT_SHELL_RECYCLE;
+static ShellWorker *idle_workers;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long served_count;
+static unsigned long recycled_count;
+static unsigned long crashed_count;
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static void make_token(char *token)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char random_bytes[SHELL_TOKEN_LEN / 2];
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 || read(fd, random_bytes, sizeof(random_bytes)) != sizeof(random_bytes))
+    {
+        // Only needs to be unlikely to show up in command output
+        for (size_t i = 0; i < sizeof(random_bytes); i++)
+            random_bytes[i] = rand();
+    }
+    if (fd != -1)
+        close(fd);
+
+    for (size_t i = 0; i < sizeof(random_bytes); i++)
+    {
+        token[2 * i] = hex[random_bytes[i] >> 4];
+        token[2 * i + 1] = hex[random_bytes[i] & 0xf];
+    }
+    token[SHELL_TOKEN_LEN] = '\0';
+}
+
+static int start_worker(ShellWorker *w)
+{
+    int in_pipe[2], out_pipe[2], status_pipe[2];
+    posix_spawn_file_actions_t actions;
+    char *args[] = {"/bin/bash", "--norc", "--noprofile", NULL};
+    char prelude[512];
+
+    w->pid = -1;
+    w->commands = 0;
+    w->broken = 0;
+    if (pipe2(in_pipe, O_CLOEXEC) == -1)
+        return -1;
+    if (pipe2(out_pipe, O_CLOEXEC) == -1)
+    {
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return -1;
+    }
+    if (pipe2(status_pipe, O_CLOEXEC) == -1)
+    {
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, status_pipe[1], 3);
+    posix_spawnattr_t attr;
+    spawn_attr_init(&attr);
+    int err = posix_spawn(&w->pid, args[0], &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    close(status_pipe[1]);
+    if (err != 0)
+    {
+        w->pid = -1;
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(status_pipe[0]);
+        errno = err;
+        return -1;
+    }
+    w->cmd_fd = in_pipe[1];
+    w->out_fd = out_pipe[0];
+    w->status_fd = status_pipe[0];
+    fcntl(w->out_fd, F_SETFL, O_NONBLOCK); // Drained to the end once the status is in
+
+    // Every command runs through __cs_run, in a subshell that can neither see
+    // the token nor redefine anything the worker relies on: stdin is detached
+    // so commands can't eat the command stream, fd 3 is closed so they can't
+    // write a status, and resource limits or a cd apply to the command alone.
+    // The worker then writes "<token> <exit status>\n" to fd 3.
+    char limits[64] = "";
+    if (spawn_limits.cpu_seconds > 0 || spawn_limits.memory_mb > 0)
+    {
+        int n = snprintf(limits, sizeof(limits), "ulimit");
+        if (spawn_limits.cpu_seconds > 0)
+            n += snprintf(limits + n, sizeof(limits) - n, " -t %d", spawn_limits.cpu_seconds);
+        if (spawn_limits.memory_mb > 0)
+            snprintf(limits + n, sizeof(limits) - n, " -v %d", spawn_limits.memory_mb * 1024);
+        strcat(limits, ";");
+    }
+    make_token(w->token);
+    snprintf(prelude, sizeof(prelude),
+             "__cs_token=%s\n"
+             "__cs_run() { (unset -v __cs_token; unset -f __cs_run; %s eval \"$1\") </dev/null 2>&1 3>&-; "
+             "builtin printf '%%s %%d\\n' \"$__cs_token\" $? >&3; }\n",
+             w->token, limits);
+    if (write_all(w->cmd_fd, prelude, strlen(prelude)) == -1)
+    {
+        w->broken = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_worker(ShellWorker *w)
+{
+    if (w->pid == -1)
+        return;
+    close(w->cmd_fd); // bash exits at end of input
+    close(w->out_fd);
+    close(w->status_fd);
+    waitpid(w->pid, NULL, 0);
+    w->pid = -1;
+}
+
+// Takes down a worker that can no longer be trusted, with everything it
+// started; it is restarted on release. Returns its wait status.
+static int kill_worker(ShellWorker *w)
+{
+    int status = 0;
+    kill(-w->pid, SIGKILL);
+    close(w->cmd_fd);
+    close(w->out_fd);
+    close(w->status_fd);
+    waitpid(w->pid, &status, 0);
+    w->pid = -1;
+    w->broken = 1;
+    return status;
+}
+
+int shell_pool_init(int size, int max_commands)
+{
+    int started = 0;
+
+    pool_size = size;
+    if (max_commands > 0)
+        recycle_after = max_commands;
+    if (size <= 0)
+        return 0;
+
+    workers = calloc(size, sizeof(ShellWorker));
+    if (workers == NULL)
+        return 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        if (start_worker(&workers[i]) == -1)
+        {
+            perror("shell worker start");
+            stop_worker(&workers[i]);
+            continue;
+        }
+        workers[i].next_idle = idle_workers;
+        idle_workers = &workers[i];
+        started++;
+    }
+    return started;
+}
+
+ShellWorker *shell_pool_acquire(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    ShellWorker *w = idle_workers;
+    if (w != NULL)
+        idle_workers = w->next_idle;
+    pthread_mutex_unlock(&pool_lock);
+    return w;
+}
+
+// Appends "'<command with ' escaped as '\''>'" to the __cs_run call
+static char *build_command_line(const char *command)
+{
+    size_t length = strlen(command);
+    char *line = malloc(4 * length + 16);
+    char *p = line;
+
+    if (line == NULL)
+        return NULL;
+    p += sprintf(p, "__cs_run '");
+    for (const char *c = command; *c; c++)
+    {
+        if (*c == '\'')
+        {
+            memcpy(p, "'\\''", 4);
+            p += 4;
+        }
+        else
+            *p++ = *c;
+    }
+    strcpy(p, "'\n");
+    return line;
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// Checks a status line against "<token> <exit status>\n"; returns 0 with
+// *exit_status set, or -1 if anything else came through fd 3
+static int parse_status(const char *line, size_t length, const char *token, int *exit_status)
+{
+    size_t token_len = strlen(token);
+    if (length < token_len + 3 || memcmp(line, token, token_len) != 0 || line[token_len] != ' ')
+        return -1;
+    char *end;
+    long status = strtol(line + token_len + 1, &end, 10);
+    if (end != line + length - 1 || *end != '\n' || status < 0 || status > 255)
+        return -1;
+    *exit_status = status;
+    return 0;
+}
+
+int shell_worker_run(ShellWorker *w, const char *command, int timeout_ms, ShellOutputFn on_output, void *ctx, int *exit_status)
+{
+    // Nothing may come from an idle worker; output now is from something an
+    // earlier command left running, and would end up in this one's reply
+    struct pollfd idle[2] = {{w->out_fd, POLLIN, 0}, {w->status_fd, POLLIN, 0}};
+    if (poll(idle, 2, 0) != 0)
+    {
+        kill_worker(w);
+        __atomic_add_fetch(&crashed_count, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    char *line = build_command_line(command);
+    if (line == NULL)
+        return -1;
+    int rc = write_all(w->cmd_fd, line, strlen(line));
+    free(line);
+    if (rc == -1)
+    {
+        w->broken = 1;
+        return -1;
+    }
+
+    // Output is forwarded as it arrives. The status line comes after the
+    // command has exited, so all of its output is in the pipe by then.
+    char buffer[SHELL_READ_SIZE];
+    char status_line[SHELL_STATUS_MAX];
+    size_t status_len = 0;
+    int have_status = 0;
+    long deadline = timeout_ms > 0 ? now_ms() + timeout_ms : 0;
+    int timed_out = 0;
+    int garbled = 0;
+
+    while (1)
+    {
+        struct pollfd fds[2] = {{w->out_fd, POLLIN, 0}, {w->status_fd, POLLIN, 0}};
+        long wait = -1;
+        if (deadline != 0 && !timed_out)
+        {
+            wait = deadline - now_ms();
+            if (wait < 0)
+                wait = 0;
+        }
+        int ready = have_status ? 1 : poll(fds, 2, wait);
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready == 0)
+        {
+            // The worker leads the process group the command runs in, so
+            // this takes down the command and everything it started; the
+            // read below then sees the worker die as in a crash
+            kill(-w->pid, SIGKILL);
+            timed_out = 1;
+            continue;
+        }
+
+        ssize_t n = 0;
+        if (have_status || fds[0].revents != 0)
+        {
+            n = read(w->out_fd, buffer, sizeof(buffer));
+            if (n == -1 && (errno == EINTR || (errno == EAGAIN && !have_status)))
+                continue;
+            if (n == -1 && errno == EAGAIN)
+                break; // Drained
+            if (n > 0)
+            {
+                on_output(ctx, buffer, n);
+                continue;
+            }
+        }
+        else
+        {
+            n = read(w->status_fd, status_line + status_len, sizeof(status_line) - status_len);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n > 0)
+            {
+                status_len += n;
+                if (memchr(status_line, '\n', status_len) != NULL)
+                {
+                    if (parse_status(status_line, status_len, w->token, exit_status) == 0)
+                        have_status = 1;
+                    else
+                        garbled = 1;
+                }
+                else if (status_len == sizeof(status_line))
+                    garbled = 1;
+                if (!garbled)
+                    continue;
+            }
+        }
+
+        // The shell died mid-command, or fd 3 carried something other than
+        // its status line: either way the worker can't be trusted any more
+        int status = kill_worker(w);
+        *exit_status = -1;
+        if (WIFEXITED(status))
+            *exit_status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            *exit_status = 128 + WTERMSIG(status);
+        if (timed_out)
+            return 1;
+        __atomic_add_fetch(&crashed_count, 1, __ATOMIC_RELAXED);
+        break;
+    }
+
+    w->commands++;
+    __atomic_add_fetch(&served_count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void shell_pool_release(ShellWorker *w)
+{
+    if (w->broken || w->commands >= recycle_after)
+    {
+        if (!w->broken)
+            __atomic_add_fetch(&recycled_count, 1, __ATOMIC_RELAXED);
+        stop_worker(w);
+        if (start_worker(w) == -1)
+        {
+            // Leave it out of the idle list; the pool just runs one short
+            perror("shell worker restart");
+            stop_worker(w);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    w->next_idle = idle_workers;
+    idle_workers = w;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void shell_pool_stats(unsigned long *served, unsigned long *recycled, unsigned long *crashed)
+{
+    *served = __atomic_load_n(&served_count, __ATOMIC_RELAXED);
+    *recycled = __atomic_load_n(&recycled_count, __ATOMIC_RELAXED);
+    *crashed = __atomic_load_n(&crashed_count, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,41 @@
+#ifndef SHELL_POOL_H
+#define SHELL_POOL_H
+
+#include <sys/types.h>
+
+#define DEFAULT_SHELL_RECYCLE 100
+
+// A long-lived bash process that runs one command at a time. Commands are
+// written to its stdin wrapped in a helper function that runs each in a
+// subshell; the command's output comes on stdout, and then the worker writes
+// a per-worker random token plus the exit status to an fd of its own.
+typedef struct ShellWorker ShellWorker;
+
+// Called with each piece of command output as it is read from the worker
+typedef void (*ShellOutputFn)(void *ctx, const char *data, int length);
+
+// Starts size workers, each replaced after max_commands commands.
+// Returns the number of workers that started.
+int shell_pool_init(int size, int max_commands);
+
+// Returns an idle worker, or NULL when all are busy (or the pool is empty)
+ShellWorker *shell_pool_acquire(void);
+
+// Runs command on worker and streams its output to on_output. Returns 0 with
+// *exit_status set once the command finished (a worker crash reports the
+// shell's exit status), or -1 if the command could not be handed to the
+// worker, in which case nothing was run and the caller should spawn it; a
+// worker with output left over from an earlier command is killed that way.
+// A status line that is not the worker's own also kills it, and the command
+// reports SIGKILL.
+// Returns 1 if the command ran past timeout_ms (0 for none): the worker was
+// killed along with everything it started, and is restarted on release.
+int shell_worker_run(ShellWorker *worker, const char *command, int timeout_ms, ShellOutputFn on_output, void *ctx, int *exit_status);
+
+// Returns worker to the pool, restarting it first if it crashed or has run
+// its quota of commands
+void shell_pool_release(ShellWorker *worker);
+
+void shell_pool_stats(unsigned long *served, unsigned long *recycled, unsigned long *crashed);
+
+#endif
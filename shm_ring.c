@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_ring.h"
+
+#define SHM_SPIN_COUNT 200 // Polls before falling back to a futex sleep
+
+static void channel_name(char *name, size_t size, pid_t client_pid)
+{
+    snprintf(name, size, SHM_CHANNEL_NAME, client_pid);
+}
+
+ShmChannel *shm_channel_create(pid_t client_pid)
+{
+    char name[64];
+    channel_name(name, sizeof(name), client_pid);
+
+    /* create the shared memory object, dropping any left over from a previous client with this PID */
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1)
+        return NULL;
+
+    /* configure the size of the shared memory object */
+    if (ftruncate(fd, sizeof(ShmChannel)) == -1)
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* map it; ftruncate already zero-filled the rings */
+    ShmChannel *channel = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (channel == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+    channel->client_pid = client_pid;
+    __atomic_store_n(&channel->magic, SHM_CHANNEL_MAGIC, __ATOMIC_RELEASE);
+    return channel;
+}
+
+ShmChannel *shm_channel_open(pid_t client_pid)
+{
+    char name[64];
+    struct stat st;
+    channel_name(name, sizeof(name), client_pid);
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(ShmChannel))
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ShmChannel *channel = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (channel == MAP_FAILED)
+        return NULL;
+    if (__atomic_load_n(&channel->magic, __ATOMIC_ACQUIRE) != SHM_CHANNEL_MAGIC || channel->client_pid != client_pid)
+    {
+        munmap(channel, sizeof(ShmChannel));
+        errno = EINVAL;
+        return NULL;
+    }
+    return channel;
+}
+
+void shm_channel_close(ShmChannel *channel)
+{
+    munmap(channel, sizeof(ShmChannel));
+}
+
+void shm_channel_unlink(pid_t client_pid)
+{
+    char name[64];
+    channel_name(name, sizeof(name), client_pid);
+    shm_unlink(name);
+}
+
+// Sleeps while *word == expected. Shared (not FUTEX_PRIVATE) because the
+// word lives in memory mapped by two processes.
+static int futex_wait(uint32_t *word, uint32_t expected, int timeout_ms)
+{
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, tsp, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Waits until ready() says the ring has room/data. waiting is our flag,
+// word the counter the peer advances; the flag is set before the final
+// re-check so a peer that advances word afterwards is sure to see it.
+static int ring_wait(ShmRing *ring, int producer, int timeout_ms)
+{
+    uint32_t *word = producer ? &ring->head : &ring->tail;
+    uint32_t *waiting = producer ? &ring->producer_waiting : &ring->consumer_waiting;
+
+    for (int spin = 0; spin < SHM_SPIN_COUNT; spin++)
+    {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (producer ? tail - head < SHM_RING_SLOTS : tail != head)
+            return 0;
+    }
+
+    while (1)
+    {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t observed = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+        if (producer ? tail - head < SHM_RING_SLOTS : tail != head)
+        {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if (futex_wait(word, observed, timeout_ms) == -1 && errno == ETIMEDOUT)
+        {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+}
+
+static size_t message_size(const Message *msg)
+{
+    int length = msg->length;
+    if (length < 0)
+        length = 0;
+    if (length > MAX_CMD_LEN)
+        length = MAX_CMD_LEN;
+    return sizeof(long) + MSG_FRAME_SIZE(length);
+}
+
+int shm_ring_push(ShmRing *ring, const Message *msg, int timeout_ms)
+{
+    if (ring_wait(ring, 1, timeout_ms) == -1)
+        return -1;
+
+    // Only the used part of the message is copied
+    uint32_t tail = ring->tail;
+    memcpy(&ring->slots[tail & (SHM_RING_SLOTS - 1)], msg, message_size(msg));
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&ring->tail);
+    return 0;
+}
+
+int shm_ring_pop(ShmRing *ring, Message *msg, int timeout_ms)
+{
+    if (ring_wait(ring, 0, timeout_ms) == -1)
+        return -1;
+
+    uint32_t head = ring->head;
+    const Message *slot = &ring->slots[head & (SHM_RING_SLOTS - 1)];
+    size_t size = message_size(slot);
+    memcpy(msg, slot, size);
+    if (msg->length < 0 || msg->length > MAX_CMD_LEN)
+        msg->length = size - offsetof(Message, command);
+    msg->command[msg->length] = '\0'; // Requests are used as C strings
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST))
+        futex_wake(&ring->head);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "protocol.h"
+
+#define SHM_RING_SLOTS 64 // Power of two
+#define SHM_CHANNEL_MAGIC 0x52494e47
+
+// Single-producer single-consumer ring of Messages in shared memory.
+// head and tail only ever grow (modulo 2^32); each side sleeps on the
+// other side's counter with a futex when the ring is empty or full, and
+// only issues FUTEX_WAKE when the peer has said it is waiting.
+typedef struct
+{
+    uint32_t tail;             // Next slot the producer writes
+    uint32_t consumer_waiting; // Consumer is asleep on tail
+    char pad1[56];             // Keep producer and consumer fields on their own cache lines
+    uint32_t head;             // Next slot the consumer reads
+    uint32_t producer_waiting; // Producer is asleep on head
+    char pad2[56];
+    Message slots[SHM_RING_SLOTS];
+} ShmRing;
+
+// One client's channel, created by the client in POSIX shared memory under
+// SHM_CHANNEL_NAME and mapped by the server when it REGISTERs
+typedef struct
+{
+    uint32_t magic;
+    pid_t client_pid;
+    ShmRing request;  // Client -> server
+    ShmRing response; // Server -> client
+} ShmChannel;
+
+// Client side: creates and maps a fresh channel for client_pid
+ShmChannel *shm_channel_create(pid_t client_pid);
+
+// Server side: maps the channel client_pid created
+ShmChannel *shm_channel_open(pid_t client_pid);
+
+void shm_channel_close(ShmChannel *channel);
+void shm_channel_unlink(pid_t client_pid);
+
+// Copy a message in or out, waiting up to timeout_ms (forever if negative)
+// for room or data. Return 0, or -1 with errno = ETIMEDOUT.
+int shm_ring_push(ShmRing *ring, const Message *msg, int timeout_ms);
+int shm_ring_pop(ShmRing *ring, Message *msg, int timeout_ms);
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "single_flight.h"
+
+#define FLIGHT_BUCKETS 256
+#define FLIGHT_REPLAY_MAX (1024 * 1024) // Output kept for late joiners; past it the flight stops taking them
+
+typedef struct Passenger
+{
+    void *ctx;
+    size_t sent; // Output it has been sent; only the leader's thread uses it
+    struct Passenger *next;
+} Passenger;
+
+struct Flight
+{
+    Flight *next; // Bucket chain
+    uint32_t hash;
+    pthread_mutex_t lock; // Guards passengers and closed
+    Passenger *passengers;
+    int closed; // Output outgrew FLIGHT_REPLAY_MAX; nobody else may join
+    char *output; // Everything published so far, replayed to each joiner; the leader's alone
+    size_t length;
+    size_t capacity;
+    char command[];
+};
+
+static FlightOutputFn send_output;
+static FlightEndFn send_end;
+static FlightBacklogFn backlog_of;
+static Flight *flights[FLIGHT_BUCKETS];
+// Taken before any flight's lock, so a flight cannot land while someone is joining it
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long led_count;
+static unsigned long joined_count;
+
+// FNV-1a
+static uint32_t hash_command(const char *command)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)command; *c != '\0'; c++)
+        hash = (hash ^ *c) * 16777619u;
+    return hash;
+}
+
+void single_flight_init(FlightOutputFn on_output, FlightEndFn on_end, FlightBacklogFn backlog)
+{
+    send_output = on_output;
+    send_end = on_end;
+    backlog_of = backlog;
+}
+
+int single_flight_enabled(void)
+{
+    return send_end != NULL;
+}
+
+// Makes room to keep length more bytes of output; returns 0, or -1 if the
+// flight has to stop taking joiners instead
+static int replay_reserve(Flight *flight, int length)
+{
+    if (flight->length + length > FLIGHT_REPLAY_MAX)
+        return -1;
+    if (flight->length + length > flight->capacity)
+    {
+        size_t capacity = flight->capacity == 0 ? 4096 : flight->capacity;
+        while (capacity < flight->length + length)
+            capacity *= 2;
+        char *grown = realloc(flight->output, capacity);
+        if (grown == NULL)
+            return -1;
+        flight->output = grown;
+        flight->capacity = capacity;
+    }
+    return 0;
+}
+
+// Sends each passenger the kept output it has not had yet
+static void catch_up(Flight *flight, Passenger *passengers)
+{
+    for (Passenger *passenger = passengers; passenger != NULL; passenger = passenger->next)
+    {
+        if (passenger->sent < flight->length)
+            send_output(passenger->ctx, flight->output + passenger->sent, flight->length - passenger->sent);
+        passenger->sent = flight->length;
+    }
+}
+
+int single_flight_join(const char *command, void *ctx, Flight **flight)
+{
+    uint32_t hash = hash_command(command);
+    Passenger *passenger = malloc(sizeof(Passenger));
+
+    pthread_mutex_lock(&flights_lock);
+    Flight *found = flights[hash % FLIGHT_BUCKETS];
+    for (; found != NULL; found = found->next)
+    {
+        if (found->hash != hash || strcmp(found->command, command) != 0)
+            continue;
+        pthread_mutex_lock(&found->lock);
+        if (!found->closed && passenger != NULL)
+            break; // Still holding its lock
+        pthread_mutex_unlock(&found->lock);
+    }
+
+    if (found != NULL)
+    {
+        // The leader sends it the output so far along with its next chunk,
+        // so the replay and the live output cannot overtake each other
+        passenger->ctx = ctx;
+        passenger->sent = 0;
+        passenger->next = found->passengers;
+        found->passengers = passenger;
+        joined_count++;
+        pthread_mutex_unlock(&found->lock);
+        pthread_mutex_unlock(&flights_lock);
+        return 1;
+    }
+
+    size_t command_length = strlen(command) + 1;
+    Flight *lead = calloc(1, sizeof(Flight) + command_length);
+    if (lead != NULL)
+    {
+        lead->hash = hash;
+        pthread_mutex_init(&lead->lock, NULL);
+        memcpy(lead->command, command, command_length);
+        lead->next = flights[hash % FLIGHT_BUCKETS];
+        flights[hash % FLIGHT_BUCKETS] = lead;
+        led_count++;
+    }
+    pthread_mutex_unlock(&flights_lock);
+    free(passenger);
+    *flight = lead;
+    return 0;
+}
+
+// Only the leader publishes and lands, so output, length and every sent are
+// its thread's alone; the lock is only taken to see who has joined, and
+// nothing is sent while holding it
+void single_flight_publish(Flight *flight, const char *data, int length)
+{
+    pthread_mutex_lock(&flight->lock);
+    int keep = !flight->closed && replay_reserve(flight, length) == 0;
+    if (!keep)
+        flight->closed = 1;
+    Passenger *passengers = flight->passengers; // Later joiners are caught up next time
+    pthread_mutex_unlock(&flight->lock);
+
+    if (keep)
+    {
+        memcpy(flight->output + flight->length, data, length);
+        flight->length += length;
+        catch_up(flight, passengers);
+        return;
+    }
+
+    // Nobody can join any more: bring everyone up to date, then pass output straight on
+    if (flight->output != NULL)
+    {
+        catch_up(flight, passengers);
+        free(flight->output);
+        flight->output = NULL;
+    }
+    for (Passenger *passenger = passengers; passenger != NULL; passenger = passenger->next)
+        send_output(passenger->ctx, data, length);
+}
+
+int single_flight_backlog(Flight *flight)
+{
+    pthread_mutex_lock(&flight->lock);
+    Passenger *passengers = flight->passengers; // Only the leader frees them, at landing
+    pthread_mutex_unlock(&flight->lock);
+
+    int most = 0;
+    for (Passenger *passenger = passengers; passenger != NULL; passenger = passenger->next)
+    {
+        int backlog = backlog_of(passenger->ctx);
+        if (backlog > most)
+            most = backlog;
+    }
+    return most;
+}
+
+void single_flight_land(Flight *flight, int exit_status)
+{
+    pthread_mutex_lock(&flights_lock);
+    Flight **link = &flights[flight->hash % FLIGHT_BUCKETS];
+    while (*link != flight)
+        link = &(*link)->next;
+    *link = flight->next;
+    pthread_mutex_unlock(&flights_lock);
+
+    // Nobody can join any more, so the passenger list is final
+    if (flight->output != NULL)
+        catch_up(flight, flight->passengers);
+    Passenger *passenger = flight->passengers;
+    while (passenger != NULL)
+    {
+        Passenger *next = passenger->next;
+        send_end(passenger->ctx, exit_status);
+        free(passenger);
+        passenger = next;
+    }
+    pthread_mutex_destroy(&flight->lock);
+    free(flight->output);
+    free(flight);
+}
+
+void single_flight_stats(unsigned long *led, unsigned long *joined)
+{
+    pthread_mutex_lock(&flights_lock);
+    *led = led_count;
+    *joined = joined_count;
+    pthread_mutex_unlock(&flights_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+// One run of a command that identical requests arriving while it runs can
+// share, instead of each starting their own process
+typedef struct Flight Flight;
+
+// How a joined request is sent output and, last, the exit status
+typedef void (*FlightOutputFn)(void *ctx, const char *data, int length);
+typedef void (*FlightEndFn)(void *ctx, int exit_status);
+// How many reply frames a joined request's client has waiting
+typedef int (*FlightBacklogFn)(void *ctx);
+
+void single_flight_init(FlightOutputFn on_output, FlightEndFn on_end, FlightBacklogFn backlog);
+
+int single_flight_enabled(void);
+
+// Returns 1 if ctx joined a run of command already in flight: ctx is sent
+// the output so far along with the leader's next output, the rest as it
+// comes, and finally the exit status, all from the leader's thread; the
+// flight owns ctx from then on. Otherwise returns 0 and sets
+// *flight to a new flight the caller leads (NULL without memory), which
+// others can join until single_flight_land().
+int single_flight_join(const char *command, void *ctx, Flight **flight);
+
+// Passes the leader's output on to everyone who joined; only the leader calls this
+void single_flight_publish(Flight *flight, const char *data, int length);
+
+// The largest backlog among everyone who joined, so the leader can hold
+// its output back for the slowest of them; only the leader calls this
+int single_flight_backlog(Flight *flight);
+
+// Ends the flight: joined requests get exit_status, and later identical
+// requests start a new run
+void single_flight_land(Flight *flight, int exit_status);
+
+void single_flight_stats(unsigned long *led, unsigned long *joined);
+
+#endif
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+
+#include "spawn.h"
+
+#define SHELL_META_CHARS "|&;<>()$`\\\"'*?[]{}~#=!\n"
+
+extern char **environ;
+
+SpawnLimits spawn_limits;
+
+int is_simple_command(const char *command)
+{
+    if (command[strspn(command, " \t")] == '\0')
+        return 0;
+    return strpbrk(command, SHELL_META_CHARS) == NULL;
+}
+
+int is_shell_builtin(const char *command)
+{
+    static const char *const builtins[] = {
+        "echo", "printf", "pwd", "cd", "true", "false", "test", "[", ":", "type", "command",
+        "export", "set", "unset", "read", "alias", "ulimit", "umask", "source", ".", "eval",
+        "exec", "hash", "help", "history", "jobs", "kill", "let", "local", "shopt", "times",
+        "trap", "wait", "declare", "typeset", "readonly", "shift", "getopts", "enable", NULL};
+    const char *start = command + strspn(command, " \t");
+    size_t length = strcspn(start, " \t");
+
+    for (int i = 0; builtins[i] != NULL; i++)
+    {
+        if (strlen(builtins[i]) == length && strncmp(start, builtins[i], length) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+void spawn_attr_init(posix_spawnattr_t *attr)
+{
+    sigset_t empty, defaults;
+    sigemptyset(&empty);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+
+    posix_spawnattr_init(attr);
+    posix_spawnattr_setsigmask(attr, &empty);
+    posix_spawnattr_setsigdefault(attr, &defaults);
+    posix_spawnattr_setpgroup(attr, 0);
+    posix_spawnattr_setflags(attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+}
+
+static int limits_wanted(void)
+{
+    return spawn_limits.cpu_seconds > 0 || spawn_limits.memory_mb > 0;
+}
+
+// Sets spawn_limits on the calling process, a child about to exec
+static int apply_limits(void)
+{
+    if (spawn_limits.cpu_seconds > 0)
+    {
+        struct rlimit cpu = {spawn_limits.cpu_seconds, spawn_limits.cpu_seconds + 1}; // SIGXCPU, then SIGKILL
+        if (setrlimit(RLIMIT_CPU, &cpu) == -1)
+            return -1;
+    }
+    if (spawn_limits.memory_mb > 0)
+    {
+        rlim_t bytes = (rlim_t)spawn_limits.memory_mb * 1024 * 1024;
+        struct rlimit memory = {bytes, bytes};
+        if (setrlimit(RLIMIT_AS, &memory) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Runs argv in a forked child. posix_spawn has no way to set rlimits in the
+// child, so commands with limits come this way: they are in force before
+// the exec, with nothing of the command running unlimited. With fallback
+// set argv[0] is looked up in PATH, and bash -c fallback runs instead when
+// it is not an executable (a builtin, or not found).
+static pid_t spawn_with_fork(char *const argv[], const char *fallback, int out_fd)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Child process: Redirect stdout to pipe and execute shell command
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        setpgid(0, 0);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(out_fd, STDERR_FILENO);
+        close(out_fd);
+        if (apply_limits() == -1)
+        {
+            static const char note[] = "setrlimit failed, command not run\n"; // No stdio: another thread may hold its lock
+            write(STDERR_FILENO, note, sizeof(note) - 1);
+            _exit(126); // Never run a command without the limits it was given
+        }
+
+        if (fallback == NULL)
+            execv(argv[0], argv);
+        else
+        {
+            execvp(argv[0], argv);
+            if (errno == ENOENT || errno == EACCES || errno == ENOEXEC)
+            {
+                char *args[] = {"/bin/bash", "-c", (char *)fallback, NULL};
+                execv(args[0], args);
+            }
+        }
+        _exit(127);
+    }
+    if (pid > 0)
+        setpgid(pid, pid); // Whichever of us runs first, the group exists before we might kill it
+    return pid;
+}
+
+static pid_t spawn_argv(char *const argv[], int out_fd, int search_path)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int err;
+
+    // glibc implements posix_spawn with clone(CLONE_VFORK), so the child
+    // shares our address space until it execs and the cost does not grow
+    // with the server's RSS the way fork() does
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_fd, STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, out_fd);
+    spawn_attr_init(&attr);
+
+    if (search_path)
+        err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    else
+        err = posix_spawn(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+static pid_t spawn_bash(const char *command, int out_fd)
+{
+    char *args[] = {"/bin/bash", "-c", (char *)command, NULL};
+    if (limits_wanted())
+        return spawn_with_fork(args, NULL, out_fd);
+    return spawn_argv(args, out_fd, 0);
+}
+
+static pid_t spawn_direct(const char *command, int out_fd)
+{
+    char copy[strlen(command) + 1];
+    char *argv[SPAWN_MAX_ARGS + 1];
+    int argc = 0;
+    char *save;
+
+    strcpy(copy, command);
+    for (char *tok = strtok_r(copy, " \t", &save); tok != NULL; tok = strtok_r(NULL, " \t", &save))
+    {
+        if (argc == SPAWN_MAX_ARGS)
+            return spawn_bash(command, out_fd);
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    if (limits_wanted())
+        return spawn_with_fork(argv, command, out_fd);
+
+    pid_t pid = spawn_argv(argv, out_fd, 1);
+    // Shell builtins (cd, ulimit, ...) and unknown commands go through bash,
+    // which also produces the usual "command not found" message
+    if (pid == -1 && (errno == ENOENT || errno == EACCES || errno == ENOEXEC))
+        return spawn_bash(command, out_fd);
+    return pid;
+}
+
+pid_t spawn_command(const char *command, int out_fd, SpawnMode mode)
+{
+    pid_t pid;
+    switch (mode)
+    {
+    case SPAWN_FORK:
+    {
+        char *args[] = {"/bin/bash", "-c", (char *)command, NULL};
+        pid = spawn_with_fork(args, NULL, out_fd);
+        break;
+    }
+    case SPAWN_BASH:
+        pid = spawn_bash(command, out_fd);
+        break;
+    case SPAWN_DIRECT:
+    default:
+        if (is_simple_command(command))
+            pid = spawn_direct(command, out_fd);
+        else
+            pid = spawn_bash(command, out_fd);
+        break;
+    }
+    return pid;
+}
+
+int parse_spawn_mode(const char *name)
+{
+    if (strcmp(name, "fork") == 0)
+        return SPAWN_FORK;
+    if (strcmp(name, "bash") == 0)
+        return SPAWN_BASH;
+    if (strcmp(name, "direct") == 0)
+        return SPAWN_DIRECT;
+    return -1;
+}
+
+const char *spawn_mode_name(SpawnMode mode)
+{
+    switch (mode)
+    {
+    case SPAWN_FORK:
+        return "fork";
+    case SPAWN_BASH:
+        return "bash";
+    default:
+        return "direct";
+    }
+}
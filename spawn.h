@@ -0,0 +1,48 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+#include <spawn.h>
+
+typedef enum
+{
+    SPAWN_FORK,   // fork() the whole server, then exec /bin/bash -c
+    SPAWN_BASH,   // posix_spawn /bin/bash -c (vfork semantics, no page-table copy)
+    SPAWN_DIRECT  // posix_spawnp the binary itself for simple commands, bash otherwise
+} SpawnMode;
+
+#define SPAWN_MAX_ARGS 64
+
+// Resource limits for every command started; 0 leaves a limit unset. They are
+// set in the child before it execs, so commands that have any are forked.
+typedef struct
+{
+    int cpu_seconds; // RLIMIT_CPU
+    int memory_mb;   // RLIMIT_AS; Linux does not enforce RLIMIT_RSS
+} SpawnLimits;
+
+extern SpawnLimits spawn_limits;
+
+// Starts command with stdout and stderr redirected to out_fd, as the leader
+// of a new process group so it can be killed along with everything it
+// starts. Returns the child's PID, or -1 with errno set.
+pid_t spawn_command(const char *command, int out_fd, SpawnMode mode);
+
+// Initializes attr so the child starts with an empty signal mask, default
+// SIGPIPE handling (whatever the server blocks or ignores itself) and its
+// own process group
+void spawn_attr_init(posix_spawnattr_t *attr);
+
+// True when command has no pipes, redirects, globs, quotes or expansions,
+// so splitting it on whitespace gives exactly what bash would have run
+int is_simple_command(const char *command);
+
+// True when the first word of command is a bash builtin or keyword, which
+// bash runs without starting a process
+int is_shell_builtin(const char *command);
+
+// Parses "fork", "bash" or "direct"; returns -1 for anything else
+int parse_spawn_mode(const char *name);
+const char *spawn_mode_name(SpawnMode mode);
+
+#endif
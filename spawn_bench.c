@@ -0,0 +1,158 @@
+/******************************************************************************
+ * File: spawn_bench.c
+ *
+ * Measures how long it takes the server to start a shell command and reap
+ * it, for each spawn path in spawn.c, while the process carries a growing
+ * amount of resident memory (like a server that has been up for a while).
+ *
+ * fork() has to copy the page tables of the whole process, so its latency
+ * grows with RSS; posix_spawn (clone with CLONE_VFORK) does not.
+ *
+ * Usage: ./spawn_bench [-n iterations] [-c command] [rss_mb ...]
+ *        (defaults: 200 iterations of "true" at 0 64 256 1024 MB)
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static long rss_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = -1;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Spawns command once, drains its output and reaps it; returns elapsed microseconds
+static double run_once(const char *command, SpawnMode mode)
+{
+    int pipefd[2];
+    char buffer[4096];
+
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        exit(1);
+    }
+
+    double start = now_us();
+    pid_t pid = spawn_command(command, pipefd[1], mode);
+    close(pipefd[1]);
+    if (pid == -1)
+    {
+        perror("spawn_command");
+        exit(1);
+    }
+    while (read(pipefd[0], buffer, sizeof(buffer)) > 0)
+        ;
+    waitpid(pid, NULL, 0);
+    double elapsed = now_us() - start;
+
+    close(pipefd[0]);
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+    const char *command = "true";
+    int default_sizes[] = {0, 64, 256, 1024};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'c':
+            command = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [-c command] [rss_mb ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1)
+        iterations = 1;
+
+    int size_count = argc - optind;
+    int *sizes = default_sizes;
+    if (size_count == 0)
+        size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    else
+    {
+        sizes = malloc(size_count * sizeof(int));
+        for (int i = 0; i < size_count; i++)
+            sizes[i] = atoi(argv[optind + i]);
+    }
+
+    double *samples = malloc(iterations * sizeof(double));
+    size_t ballast_bytes = 0;
+    char *ballast = NULL;
+
+    printf("command: '%s' (%s), %d iterations per cell\n", command,
+           is_simple_command(command) ? "simple, eligible for direct exec" : "needs bash", iterations);
+    printf("%10s %8s %12s %12s %12s\n", "rss_mb", "path", "mean_us", "p50_us", "p99_us");
+
+    for (int s = 0; s < size_count; s++)
+    {
+        // Grow the ballast and touch every page so it is really resident
+        size_t want = (size_t)sizes[s] << 20;
+        if (want > ballast_bytes)
+        {
+            ballast = realloc(ballast, want);
+            if (ballast == NULL)
+            {
+                perror("realloc ballast");
+                return 1;
+            }
+            memset(ballast + ballast_bytes, 1, want - ballast_bytes);
+            ballast_bytes = want;
+        }
+
+        SpawnMode modes[] = {SPAWN_FORK, SPAWN_BASH, SPAWN_DIRECT};
+        for (int m = 0; m < 3; m++)
+        {
+            double total = 0;
+            for (int i = 0; i < iterations; i++)
+            {
+                samples[i] = run_once(command, modes[m]);
+                total += samples[i];
+            }
+            qsort(samples, iterations, sizeof(double), compare_double);
+            printf("%10ld %8s %12.1f %12.1f %12.1f\n", rss_kb() / 1024, spawn_mode_name(modes[m]),
+                   total / iterations, samples[iterations / 2], samples[(int)(iterations * 0.99)]);
+        }
+    }
+
+    free(samples);
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/******************************************************************************
+ * File: transport_bench.c
+ *
+ * Compares request/response round trips over the System V message queues
+ * with the per-client shared-memory rings (shm_ring.c) against a running
+ * server. Each simulated client is a separate process that REGISTERs,
+ * sends the same command back to back, waits for the end of every reply
+ * and EXITs.
+ *
+ * Usage: ./transport_bench [-t sysv|shm|mq|both] [-c clients] [-n requests] [-m command]
+ *        (defaults: both transports, 1 client, 10000 requests of "LIST")
+ *        Start the server first, with its output redirected to /dev/null.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "bench_client.h"
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_client(const char *transport, const char *command, int requests, double *latencies)
+{
+    if (bench_connect(transport) == -1)
+    {
+        perror("bench_connect");
+        _exit(1);
+    }
+    bench_send("REGISTER");
+    bench_wait_reply();
+
+    for (int i = 0; i < requests; i++)
+    {
+        double start = bench_now_us();
+        bench_send(command);
+        bench_wait_reply();
+        latencies[i] = bench_now_us() - start;
+    }
+
+    bench_send("EXIT");
+    bench_wait_reply();
+    bench_disconnect();
+}
+
+static void run(const char *transport, int clients, int requests, const char *command)
+{
+    size_t total = (size_t)clients * requests;
+    double *latencies = mmap(NULL, total * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latencies == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+
+    double start = bench_now_us();
+    for (int c = 0; c < clients; c++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            run_client(transport, command, requests, latencies + (size_t)c * requests);
+            _exit(0);
+        }
+        if (pid == -1)
+        {
+            perror("fork");
+            exit(1);
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+    double elapsed = bench_now_us() - start;
+
+    qsort(latencies, total, sizeof(double), compare_double);
+    printf("%6s %8d %10zu %12.0f %10.1f %10.1f %10.1f\n", transport, clients, total, total / (elapsed / 1e6),
+           latencies[total / 2], latencies[(size_t)(total * 0.99)], latencies[(size_t)(total * 0.999)]);
+    munmap(latencies, total * sizeof(double));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *transport = "both";
+    const char *command = "LIST";
+    int clients = 1;
+    int requests = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:n:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            transport = optarg;
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 'm':
+            command = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t sysv|shm|mq|both] [-c clients] [-n requests] [-m command]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (clients < 1 || requests < 1)
+        return 1;
+
+    // "mq" needs a server started with -E, the others the default one
+    if (bench_connect(strcmp(transport, "mq") == 0 ? "mq" : "sysv") == -1)
+    {
+        perror("connect (is the server running?)");
+        return 1;
+    }
+    bench_disconnect();
+
+    printf("command '%s'\n%6s %8s %10s %12s %10s %10s %10s\n", command, "path", "clients", "requests", "msgs/sec", "p50_us", "p99_us", "p999_us");
+    if (strcmp(transport, "sysv") == 0 || strcmp(transport, "both") == 0)
+        run("sysv", clients, requests, command);
+    if (strcmp(transport, "shm") == 0 || strcmp(transport, "both") == 0)
+        run("shm", clients, requests, command);
+    if (strcmp(transport, "mq") == 0)
+        run("mq", clients, requests, command);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+// Just enough io_uring for the reactors, over the raw system calls: a
+// submission and a completion ring shared with the kernel, filled and
+// drained here and handed over with one io_uring_enter() per batch.
+typedef struct
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_pending; // Queued since the last io_uring_enter()
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned long enters; // io_uring_enter() calls so far
+} Uring;
+
+// Sets up a ring of entries submission slots. Returns -1 with errno set if
+// the kernel has no io_uring, has it disabled, or lacks the waiting with a
+// timeout (IORING_FEAT_EXT_ARG, Linux 5.11) that uring_submit_and_wait needs.
+int uring_init(Uring *ring, unsigned entries);
+void uring_exit(Uring *ring);
+
+// Registers buffers for IORING_OP_READ_FIXED; returns 0 or -1
+int uring_register_buffers(Uring *ring, const struct iovec *buffers, unsigned count);
+
+// Returns a zeroed submission slot to fill in, submitting what is queued
+// first if the ring is full. The slot goes to the kernel with the next
+// uring_submit_and_wait().
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+// Submits everything queued and waits up to timeout_ms (forever if negative)
+// for at least one completion. Returns 0, or -1 with errno set (ETIME when
+// the wait timed out, EINTR).
+int uring_submit_and_wait(Uring *ring, int timeout_ms);
+
+// The oldest completion not seen yet, or NULL
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+#endif